@@ -12,6 +12,8 @@
  * Inputs:  argv[1],    txclean.dat
  *
  * Outputs: argv[2]     candidate block cblock.dat
+ *          argv[1]     rewritten sorted on tx_id without duplicates,
+ *                      if server() has appended to it.
  *          exit status 0=block make, or non-zero=no block.
 */
 
@@ -38,6 +40,7 @@ word32 Tnum = -1;  /* transaction sequence number */
 void bail(char *message)
 {
    if(message) error("bcon: bailing out: %s (%d)", message, Tnum);
+   unlink("txclean.tmp");
    exit(1);
 }
 
@@ -47,6 +50,7 @@ void bail(char *message)
  */
 void sigterm2(int sig)
 {
+   unlink("txclean.tmp");
    unlink("cblock.tmp");
    unlink("cblock.dat");
    unlink("bctx.dat");
@@ -60,6 +64,7 @@ int main(int argc, char **argv)
    static TXQENTRY tx;     /* Holds one transaction in the array */
    FILE *fp;               /* to read txclean.dat file */
    FILE *fpout;            /* for cblock.dat */
+   FILE *fpclean;          /* for sorted txclean.tmp */
    word32 bnum[2];         /* new block num */
    int count;
    SHA256_CTX mctx;     /* to hash transaction array */
@@ -69,7 +74,7 @@ int main(int argc, char **argv)
    word32 *idx;
    byte prev_tx_id[HASHLEN];  /* to check for duplicate transactions */
    int cond;
-   word32 ntx;
+   word32 ntx, pos;
    static word32 mreward[2];
 
    fix_signals();
@@ -106,6 +111,20 @@ badread:
       bail("Cannot open [txclean.dat]");
    }
 
+   /* If server() appended TX's, txclean.dat is no longer in
+    * strict tx_id order: write a sorted copy without duplicates
+    * so that bup can merge it in one forward pass.
+    */
+   fpclean = NULL;
+   for(Tnum = 1; Tnum < Ntx; Tnum++) {
+      if(memcmp(&Tx_ids[(Tnum - 1) * HASHLEN], &Tx_ids[Tnum * HASHLEN],
+                HASHLEN) >= 0) {
+         fpclean = fopen("txclean.tmp", "wb");
+         if(!fpclean) bail("Cannot write [txclean.tmp]");
+         break;
+      }
+   }
+
    /* create cblock.dat */
    fpout = fopen("cblock.tmp", "wb");
    if(!fpout) {
@@ -142,7 +161,9 @@ badwrite:
     * using Txidx[].
     */
    ntx = 0;
-   for(idx = Txidx, Tnum = 0; Tnum < Ntx && ntx < MAXBLTX; Tnum++, idx++) {
+   pos = 0;  /* next record in txclean.dat */
+   for(idx = Txidx, Tnum = 0; Tnum < Ntx; Tnum++, idx++) {
+      if(ntx >= MAXBLTX && fpclean == NULL) break;
       if(Tnum != 0) {
          cond = memcmp(&Tx_ids[*idx * HASHLEN], prev_tx_id, HASHLEN);
          if(cond < 0)
@@ -151,11 +172,17 @@ badwrite:
       }
       memcpy(prev_tx_id, &Tx_ids[*idx * HASHLEN], HASHLEN);
 
-      if(fseek(fp, *idx * sizeof(TXQENTRY), SEEK_SET) != 0)
+      if(*idx != pos && fseek(fp, *idx * sizeof(TXQENTRY), SEEK_SET) != 0)
          bail("bad seek on txclean.dat");
 
       count = fread(&tx, 1, sizeof(TXQENTRY), fp);
       if(count != sizeof(TXQENTRY)) goto badread;
+      pos = *idx + 1;
+      if(fpclean) {
+         count = fwrite(&tx, 1, sizeof(TXQENTRY), fpclean);
+         if(count != sizeof(TXQENTRY)) bail("Cannot write [txclean.tmp]");
+      }
+      if(ntx >= MAXBLTX) continue;  /* block is full */
       ntx++;  /* actual transactions for block */
       sha256_update(&bctx, (byte *) &tx, sizeof(TXQENTRY));  /* entire block */
       sha256_update(&mctx, (byte *) &tx, sizeof(TXQENTRY));  /* Merkel Array */
@@ -165,6 +192,14 @@ badwrite:
 
    sha256_final(&mctx, bt.mroot);  /* put the Merkel root in trailer */
 
+   if(fpclean) {
+      fclose(fp);
+      fp = NULL;
+      if(fclose(fpclean) != 0 || rename("txclean.tmp", argv[1]) != 0)
+         bail("Cannot rename [txclean.tmp]");
+      if(Trace) plog("bcon: sorted txclean.dat");
+   }
+
    /* Put tran count in trailer */
    if(ntx == 0) {
       if(Trace) plog("bcon: no good transactions");
@@ -188,8 +223,8 @@ badwrite:
 
    if(Tx_ids) free(Tx_ids);    /* sorttx() allocated these two */
    if(Txidx) free(Txidx);
-   fclose(fp);      /* txclean.dat */
-   fclose(fpout);   /* cblock.dat */
+   if(fp) fclose(fp);  /* txclean.dat */
+   fclose(fpout);      /* cblock.dat */
 
    /* save bctx to disk for miner */
    if(write_data(&bctx, sizeof(bctx), "bctx.dat") != VEOK)
@@ -0,0 +1,157 @@
+/* blockrd.c  Memory-mapped block reader
+ *
+ * Copyright (c) 2018 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.TXT   **** NO WARRANTY ****
+ *
+ * The Mochimo Project System Software
+ *
+ * Date: 19 October 2026
+ *
+ * br_open() maps a block file read-only and checks that hdrlen,
+ * tcount, and the file length agree before anything is handed out:
+ *
+ *    regular block:   BHEADER, tcount * TXQENTRY, BTRAILER
+ *    (neo-)genesis:   hdrlen, ledger of LENTRY's, BTRAILER
+ *
+ * br_tx() then returns pointers to TXQENTRY's in the map, so
+ * callers read transactions without copying them, and br_copy()
+ * copies part of the block to another file inside the kernel.
+ * Needs only get32() from the including program.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+typedef struct {
+   byte *map;          /* whole block file, read-only */
+   int fd;             /* kept open for br_copy() */
+   size_t len;         /* file length */
+   word32 hdrlen;      /* header length */
+   word32 tcount;      /* TX's in Merkel array: 0 for (neo-)genesis */
+   BHEADER *bh;        /* regular header, or NULL for (neo-)genesis */
+   BTRAILER *bt;       /* trailer at end of file */
+   TXQENTRY *tx;       /* Merkel array tx[0...tcount-1] */
+} BLOCKRD;
+
+
+/* Close a block opened by br_open().  Safe to call twice. */
+void br_close(BLOCKRD *br)
+{
+   if(br->map) {
+      munmap(br->map, br->len);
+      close(br->fd);
+   }
+   memset(br, 0, sizeof(BLOCKRD));
+}
+
+
+/* Map fname into br and check its layout.
+ * Returns VEOK, VERROR if it cannot be read,
+ * VEBAD2 if a regular block's tcount is over MAXBLTX, or
+ * VEBAD if the lengths in the block do not match the file.
+ */
+int br_open(BLOCKRD *br, char *fname)
+{
+   struct stat st;
+   int fd, ecode;
+
+   memset(br, 0, sizeof(BLOCKRD));
+   fd = open(fname, O_RDONLY);
+   if(fd < 0) return VERROR;
+   if(fstat(fd, &st) != 0) {
+      close(fd);
+      return VERROR;
+   }
+   if(st.st_size < (off_t) (4 + sizeof(BTRAILER))) {
+      close(fd);
+      return VEBAD;
+   }
+   br->len = st.st_size;
+   br->map = mmap(NULL, br->len, PROT_READ, MAP_SHARED, fd, 0);
+   if(br->map == MAP_FAILED) {
+      close(fd);
+      br->map = NULL;
+      return VERROR;
+   }
+   br->fd = fd;
+   madvise(br->map, br->len, MADV_SEQUENTIAL);
+
+   ecode = VEBAD;
+   br->hdrlen = get32(br->map);
+   br->bt = (BTRAILER *) (br->map + br->len - sizeof(BTRAILER));
+   if(br->hdrlen < 4 || br->hdrlen > br->len - sizeof(BTRAILER)) goto bad;
+
+   if(br->hdrlen == sizeof(BHEADER)) {
+      br->bh = (BHEADER *) br->map;
+      br->tx = (TXQENTRY *) (br->map + br->hdrlen);
+      br->tcount = get32(br->bt->tcount);
+      if(br->tcount > MAXBLTX) { ecode = VEBAD2;  goto bad; }
+      if(br->len != br->hdrlen + (size_t) br->tcount * sizeof(TXQENTRY)
+                         + sizeof(BTRAILER)) goto bad;
+   } else {
+      /* (neo-)genesis block: header is a ledger */
+      if((br->hdrlen - 4) % sizeof(LENTRY) != 0
+         || br->len != br->hdrlen + sizeof(BTRAILER)) goto bad;
+   }
+   return VEOK;
+bad:
+   br_close(br);
+   return ecode;
+}  /* end br_open() */
+
+
+/* Return pointer to TX number n of the Merkel array, or NULL. */
+TXQENTRY *br_tx(BLOCKRD *br, word32 n)
+{
+   if(n >= br->tcount) return NULL;
+   return &br->tx[n];
+}
+
+
+/* Copy len bytes at offset off in the block to a new file fname.
+ * Uses copy_file_range() where the kernel has it, and falls back
+ * to write() from the map.
+ * Returns VEOK, or VERROR with fname removed.
+ */
+int br_copy(BLOCKRD *br, size_t off, size_t len, char *fname)
+{
+   int ofd;
+   long n;
+   size_t end;
+#ifdef SYS_copy_file_range
+   long long inoff;
+#endif
+
+   if(off > br->len || len > br->len - off) return VERROR;
+   ofd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if(ofd < 0) return VERROR;
+   end = off + len;
+#ifdef SYS_copy_file_range
+   while(off < end) {
+      inoff = off;
+      n = syscall(SYS_copy_file_range, br->fd, &inoff, ofd, NULL,
+                  end - off, 0);
+      if(n <= 0) break;  /* not supported here: finish with write() */
+      off += n;
+   }
+#endif
+   while(off < end) {
+      n = write(ofd, br->map + off, end - off);
+      if(n <= 0) goto bad;
+      off += n;
+   }
+   if(close(ofd) != 0) {
+      unlink(fname);
+      return VERROR;
+   }
+   return VEOK;
+bad:
+   close(ofd);
+   unlink(fname);
+   return VERROR;
+}  /* end br_copy() */
@@ -12,10 +12,17 @@
  * Inputs:  argv[1],    mined block or valid received block
  *          ledger.dat  sorted
  *          ltran.dat   pre-sorted by sortlt.exe
+ *          txclean.dat sorted on tx_id by bcon (if not, sorttx() is used)
  *
  * Outputs: if argv[2] != NULL, rename(argv[1], argv[2]) on success.
  *          updates ledger.dat by applying ltran.dat deltas
- *          removes transactions from txclean.dat
+ *          update.jnl  journal for init() if the update is cut short,
+ *          ledger.bak  and the old ledger: both removed by update()
+ *          txclean.del tombstone bitmap of txclean.dat records to remove:
+ *                      txclean applies it when it next rewrites txclean.dat
+ *          ngblock.tmp if argv[1] is block 0x..ff, the neo-genesis block
+ *                      written in the same pass as ledger.dat for
+ *                      do_neogen() (bupdata.c)
  *          exit status 0=block update, or non-zero=error.
 */
 
@@ -34,14 +41,33 @@
 #include "util.c"
 #include "sorttx.c"
 #include "daemon.c"
+#include "blockrd.c"
 
 word32 Tnum = -1;  /* transaction sequence number */
 
+/* Tombstone bitmap for txclean.dat: bit j set removes record j */
+word32 Ndel;         /* number of records in txclean.dat */
+byte *Delmap;        /* malloc'd Delmap[(Ndel + 7) / 8] */
+BLOCKRD Br;          /* the new block, mapped */
+
+/* Neo-genesis block built alongside the new ledger */
+FILE *Nfp;           /* ngblock.tmp, or NULL */
+SHA256_CTX Bctx;     /* running hash of ngblock.tmp */
+word32 Ngcount;      /* ledger entries it will hold */
+
+byte Jnl;            /* set once update.jnl is written */
+
 void cleanup(int ecode)
 {
    write_data("fail", 4, "ufail.lck");
+   if(Jnl) {
+      /* undo the ledger swap */
+      if(exists("ledger.bak")) rename("ledger.bak", "ledger.dat");
+      unlink("update.jnl");
+   }
    unlink("ledger.tmp");
-   unlink("txq.tmp");
+   unlink("txclean.del");
+   unlink("ngblock.tmp");
    unlink("ltran.dat");
    if(ecode >= 2)
       write_data("pink", 4, "ubad.lck");
@@ -63,17 +89,245 @@ void badtran(char *message)
 }
 
 
+/* Merge one txclean.dat tx_id, presented in sorted order, against
+ * the new block's Merkel array and mark record j for removal if it is
+ * in the block or repeats the previous tx_id.
+ * Returns 1 if marked, else 0.
+ */
+int markid(word32 j, byte *id, int first)
+{
+   static byte prev[HASHLEN];
+   static word32 b;
+   int cond;
+
+   if(first) b = 0;
+   else if(memcmp(id, prev, HASHLEN) == 0) goto mark;  /* duplicate */
+   memcpy(prev, id, HASHLEN);
+   for(cond = 1; b < Br.tcount; b++) {
+      cond = memcmp(Br.tx[b].tx_id, id, HASHLEN);
+      if(cond >= 0) break;
+   }
+   if(cond != 0) return 0;
+mark:
+   Delmap[j >> 3] |= (1 << (j & 7));
+   return 1;
+}
+
+
+/* Build the tombstone bitmap for txclean.dat in one forward pass,
+ * reading only tx_id's.  If bcon did not leave the file sorted,
+ * fall back to the sorttx() index.
+ * Returns the number of records marked for removal, or -1 on error.
+ */
+long txmark(char *fname)
+{
+   FILE *fp;
+   long offset, nmark;
+   word32 j;
+   byte id[HASHLEN], prev[HASHLEN];
+
+   fp = fopen(fname, "rb");
+   if(fp == NULL) return -1;
+   if(fseek(fp, 0, SEEK_END) != 0) goto bad;
+   offset = ftell(fp);
+   if((offset % sizeof(TXQENTRY)) != 0) goto bad;
+   Ndel = offset / sizeof(TXQENTRY);
+   Delmap = calloc(1, (Ndel + 7) / 8 + 1);
+   if(Delmap == NULL) goto bad;
+   if(fseek(fp, 0, SEEK_SET) != 0) goto bad;
+
+   /* forward merge in file order */
+   for(j = 0, nmark = 0; j < Ndel; j++) {
+      if(fseek(fp, sizeof(TXQENTRY) - HASHLEN, SEEK_CUR) != 0) goto bad;
+      if(fread(id, 1, HASHLEN, fp) != HASHLEN) goto bad;
+      if(j > 0 && memcmp(id, prev, HASHLEN) < 0) break;  /* not sorted */
+      memcpy(prev, id, HASHLEN);
+      nmark += markid(j, id, j == 0);
+   }
+   fclose(fp);
+   if(j >= Ndel) return nmark;
+
+   /* txclean.dat is out of order: merge in sorted index order */
+   if(Trace) plog("bup.c: txclean.dat not sorted at %u", j);
+   if(sorttx(fname) != VEOK) return -1;
+   memset(Delmap, 0, (Ndel + 7) / 8);
+   for(j = 0, nmark = 0; j < Ntx; j++)
+      nmark += markid(Txidx[j], &Tx_ids[Txidx[j] * HASHLEN], j == 0);
+   return nmark;
+bad:
+   fclose(fp);
+   return -1;
+}  /* end txmark() */
+
+
+/* Predict how many entries the merge will write to the new ledger,
+ * so that the neo-genesis header length is known before it starts.
+ * Each address in ltran.dat is looked up in ledger.dat by binary
+ * search and its deltas applied as the merge would apply them.
+ * Opens the files itself, so the merge's handles are not moved.
+ * Returns the count, or 0 on error.
+ */
+word32 ngcount(void)
+{
+   LENTRY le;
+   LTRAN lt;
+   FILE *lfp, *tfp;
+   byte addr[TXADDRLEN];
+   word32 bal[2], nout;
+   long lo, hi, mid, lcount;
+   int cond, found, more;
+
+   nout = 0;
+   lfp = fopen("ledger.dat", "rb");
+   tfp = fopen("ltran.dat", "rb");
+   if(lfp == NULL || tfp == NULL) goto out;
+   if(fseek(lfp, 0, SEEK_END) != 0) goto out;
+   lcount = ftell(lfp) / sizeof(LENTRY);
+   nout = lcount;
+   more = (fread(&lt, 1, sizeof(LTRAN), tfp) == sizeof(LTRAN));
+   while(more) {
+      memcpy(addr, lt.addr, TXADDRLEN);
+      for(found = 0, lo = 0, hi = lcount - 1; lo <= hi; ) {
+         mid = (lo + hi) / 2;
+         if(fseek(lfp, mid * sizeof(LENTRY), SEEK_SET) != 0
+            || fread(&le, 1, sizeof(LENTRY), lfp) != sizeof(LENTRY))
+               goto bad;
+         cond = memcmp(le.addr, addr, TXADDRLEN);
+         if(cond == 0) { found = 1; break; }
+         if(cond < 0) lo = mid + 1; else hi = mid - 1;
+      }
+      if(found) memcpy(bal, le.balance, 8);
+      else memset(bal, 0, 8);
+      do {
+         if(lt.trancode[0] == '+') add64(bal, lt.amount, bal);
+         else if(cmp64(bal, lt.amount) < 0) goto bad;  /* merge fails */
+         else sub64(bal, lt.amount, bal);
+         more = (fread(&lt, 1, sizeof(LTRAN), tfp) == sizeof(LTRAN));
+      } while(more && memcmp(lt.addr, addr, TXADDRLEN) == 0);
+      if(cmp64(bal, Mfee) > 0) {
+         if(!found) nout++;
+      } else if(found) nout--;
+   }
+   goto out;
+bad:
+   nout = 0;
+out:
+   if(lfp) fclose(lfp);
+   if(tfp) fclose(tfp);
+   return nout;
+}  /* end ngcount() */
+
+
+/* Abandon ngblock.tmp: do_neogen() will run neogen instead. */
+void ngdrop(void)
+{
+   if(Nfp == NULL) return;
+   fclose(Nfp);
+   Nfp = NULL;
+   unlink("ngblock.tmp");
+   if(Trace) plog("bup.c: neo-genesis block left to neogen");
+}
+
+
+/* Begin ngblock.tmp with the predicted header length. */
+void ngopen(void)
+{
+   word32 hdrlen;
+
+   Ngcount = ngcount();
+   if(Ngcount == 0) return;
+   Nfp = fopen("ngblock.tmp", "wb");
+   if(Nfp == NULL) return;
+   hdrlen = Ngcount * sizeof(LENTRY) + 4;
+   if(fwrite(&hdrlen, 1, 4, Nfp) != 4) {
+      ngdrop();
+      return;
+   }
+   sha256_init(&Bctx);   /* begin entire block hash */
+   sha256_update(&Bctx, (byte *) &hdrlen, 4);
+}
+
+
+/* Write ledger entry le to the new ledger and, at the end of
+ * an Eon, to the neo-genesis block and its hash.
+ * Returns the count written to fpout.
+ */
+int lwrite(LENTRY *le, FILE *fpout)
+{
+   if(Nfp) {
+      if(fwrite(le, 1, sizeof(LENTRY), Nfp) != sizeof(LENTRY)) ngdrop();
+      else sha256_update(&Bctx, (byte *) le, sizeof(LENTRY));
+   }
+   return fwrite(le, 1, sizeof(LENTRY), fpout);
+}
+
+
+/* Finish ngblock.tmp with a trailer that follows block bt.
+ * nout is the number of entries actually written to the ledger.
+ */
+void ngclose(BTRAILER *bt, word32 nout)
+{
+   static BTRAILER nbt;
+
+   if(Nfp == NULL) return;
+   if(nout != Ngcount) {
+      error("bup.c: neo-genesis count %u != %u", Ngcount, nout);
+      ngdrop();
+      return;
+   }
+   memcpy(nbt.phash, bt->bhash, HASHLEN);
+   add64(bt->bnum, One, nbt.bnum);
+   put32(nbt.stime, get32(bt->stime));
+   put32(nbt.time0, get32(bt->time0));
+   put32(nbt.difficulty, get32(bt->difficulty));
+   sha256_update(&Bctx, (byte *) &nbt, sizeof(BTRAILER) - HASHLEN);
+   sha256_final(&Bctx, nbt.bhash);
+   if(fwrite(&nbt, 1, sizeof(BTRAILER), Nfp) != sizeof(BTRAILER)) {
+      ngdrop();
+      return;
+   }
+   if(fclose(Nfp) != 0) unlink("ngblock.tmp");
+   Nfp = NULL;
+}  /* end ngclose() */
+
+
+/* Write and sync update.jnl, and its directory entry, for the
+ * update to block bt, so that init() can finish or undo it after a
+ * crash.
+ */
+int write_jnl(BTRAILER *bt)
+{
+   UJOURNAL jnl;
+   struct stat st;
+   int fd;
+
+   memset(&jnl, 0, sizeof(jnl));
+   put64(jnl.bnum, bt->bnum);
+   memcpy(jnl.bhash, bt->bhash, HASHLEN);
+   if(stat("tfile.dat", &st) != 0) return VERROR;
+   put32(jnl.tflen, st.st_size);
+   put16(jnl.crc16, crc16(&jnl, sizeof(jnl) - 2));
+   fd = open("update.jnl", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if(fd < 0) return VERROR;
+   Jnl = 1;
+   if(write(fd, &jnl, sizeof(jnl)) != sizeof(jnl) || fsync(fd) != 0) {
+      close(fd);
+      return VERROR;
+   }
+   close(fd);
+   return syncdir(".");
+}  /* end write_jnl() */
+
+
 /* Invocation: bup mblock.dat ublock.bc */
 int main(int argc, char **argv)
 {
-   static TXQENTRY tx;     /* Holds one transaction in the array */
    FILE *fp;
    FILE *fpout;
-   FILE *bfp;              /* to read the new block */
    FILE *lfp;              /* ledger.dat */
    word32 hdrlen;          /* for block header length */
    int count;
-   word32 *idx;
+   long nmark;
    int cond;
    LENTRY oldle;     /* input ledger entry  */
    LENTRY newle;     /* output ledger entry */
@@ -82,7 +336,6 @@ int main(int argc, char **argv)
    byte leof, teof;  /* end of file flags   */
    byte hold;        /* hold ledger entry for next loop */
    word32 nout;      /* temp file output record counter */
-   word32 j, bcount;
    static BHEADER bh;
    static BTRAILER bt;
    word32 diff[2];
@@ -100,6 +353,8 @@ int main(int argc, char **argv)
 
    /* created on exit() to pinklist() Peerip in update() */
    unlink("ubad.lck");
+   unlink("txclean.del");
+   unlink("ngblock.tmp");
 
    /* get global block number, peer ip, etc. */
    if(read_global() != VEOK)
@@ -108,130 +363,48 @@ int main(int argc, char **argv)
    if(Trace) Logfp = fopen(LOGFNAME, "a");
 
    SORTLTCMD();            /* sort the ledger transaction file -- wait */
-   /* build sorted index Txidx[] from txclean.dat */
-   if(exists("txclean.dat")) {
-      if(sorttx("txclean.dat") != VEOK)
-         bail("sorttx('txclean.dat') failed!");
-   }
 
-   /***** Open the block file. *****
+   /***** Map the block file. *****
     *  It has already been validated.
     */
-   bfp = fopen(argv[1], "rb");
-   if(!bfp) {
-badblock:
+   if(br_open(&Br, argv[1]) != VEOK) {
       error("Cannot read %s", argv[1]);
       bail("");
    }
-   /* read block header */
-   if(fread(&hdrlen, 1, 4, bfp) != 4) goto badblock;
+   hdrlen = Br.hdrlen;
    /* fixed length regular block header */
    if(hdrlen != sizeof(bh)) bail("bad hdrlen");
-   if(fseek(bfp, 0, SEEK_SET)) goto badblock;
-   if(fread(&bh, 1, sizeof(BHEADER), bfp) != sizeof(BHEADER)) goto badblock;
-   /* read block trailer */
-   if(fseek(bfp, -(sizeof(BTRAILER)), SEEK_END)) goto badblock;
-   if(fread(&bt, 1, sizeof(BTRAILER), bfp) != sizeof(BTRAILER)) goto badblock;
+   memcpy(&bh, Br.bh, sizeof(BHEADER));
+   memcpy(&bt, Br.bt, sizeof(BTRAILER));
 
    if(sub64(bt.bnum, Cblocknum, diff) || diff[0] != 1 || diff[1] != 0)
       bail("bt.bnum - Cblocknum != 1");
 
-   /* re-open the clean TX queue (txclean.dat) to read */
-   fp = fopen("txclean.dat", "rb");
-   if(!fp) {
-      fclose(bfp);     /* block */
-      goto noclean;
-   }
+   if(!exists("txclean.dat")) goto noclean;
 
-   /* create new clean TX queue */
-   fpout = fopen("txq.tmp", "wb");
-   if(!fpout) {
-badtemp:
-      bail("Cannot write txq.tmp");
-   }
-
-   /***** Read Merkel Block Array from new block *****/
-   if(fseek(bfp, hdrlen, SEEK_SET)) goto badblock;
-
-   /* Remove TX_ID's from clean TX queue that are in the new block. 
-    * Merkel Array in new block is already sorted on TX_ID;
+   /* The Merkel Block Array in Br is already sorted on TX_ID;
     * bval checks this in foreign blocks.
-    * Above we sorted clean queue, txclean.dat, with sorttx() call.
-    *
-    * NOTE: end of file check on Merkel Block (bfp) depends on block
-    *       trailer being shorter than a TXQENTRY !
     */
-
-   nout = 0;    /* output counter */
-   bcount = 0;  /* block counter */
-   j = 0;       /* counter for block transactions */
-   idx = Txidx;  /* *idx is its index */
-
-   for( ; j < Ntx; ) {
-      /* read the next tran. from the block array */
-      count = fread(&tx, 1, sizeof(TXQENTRY), bfp);
-      /* At end of Merkel Block, copy rest of txclean.dat to temp file */
-      if(count < sizeof(TXQENTRY)) {  /* EOF */
-         for( ; j < Ntx; j++, idx++) {
-            /* Check for dups in txclean.dat */
-            if(j > 0
-               && memcmp(&Tx_ids[idx[-1] * HASHLEN], 
-                         &Tx_ids[*idx * HASHLEN], HASHLEN) == 0) continue;
-            /* Read clean TX in sorted order using index. */
-            if(fseek(fp, *idx * sizeof(TXQENTRY), SEEK_SET) != 0) {
-badclean:
-               bail("Cannot read txclean.dat");
-               goto badclean;
-            }
-            count = fread(&tx, 1, sizeof(TXQENTRY), fp);
-            if(count != sizeof(TXQENTRY)) goto badclean;
-            count = fwrite(&tx, 1, sizeof(TXQENTRY), fpout); 
-            if(count != sizeof(TXQENTRY)) goto badtemp;
-            nout++;
-         }  /* end for j */
-         break;  /* done */
-      }  /* end if block EOF */
-
-      bcount++;  /* count transactions in block */
-
-nextclean:
-      /* Otherwise check if block tx matches clean tx... */
-      cond = memcmp(tx.tx_id, &Tx_ids[*idx * HASHLEN], HASHLEN);
-      if(cond == 0) goto next2;  /* skip dup tran. */
-      /* ... or if the Merkel Block has a higher TX_ID
-       * copy the clean TX to temp file.
-       */
-      if(cond > 0) {
-         if(fseek(fp, *idx * sizeof(TXQENTRY), SEEK_SET) != 0)
-            goto badclean;
-         count = fread(&tx, 1, sizeof(TXQENTRY), fp);
-         if(count != sizeof(TXQENTRY)) goto badclean;
-         count = fwrite(&tx, 1, sizeof(TXQENTRY), fpout);
-         if(count != sizeof(TXQENTRY)) goto badtemp;
-         nout++;  /* count output records to temp file -- new txclean */
-next2:   /* examine next clean TX */
-         j++;
-         idx++;
-         if(j >= Ntx) break;  /* done -- end of clean TX file */
-         /* skip dups in txclean.dat */
-         if(memcmp(&Tx_ids[idx[-1] * HASHLEN], 
-                   &Tx_ids[*idx * HASHLEN], HASHLEN) == 0) goto next2;
-         goto nextclean;
+   /* Mark TX_ID's in clean TX queue that are in the new block,
+    * and any duplicates, for txclean to remove.
+    */
+   nmark = txmark("txclean.dat");
+   if(nmark < 0) bail("Cannot read txclean.dat");
+   if(nmark) {
+      fp = fopen("txclean.del", "wb");
+      if(fp == NULL) bail("Cannot write txclean.del");
+      if(fwrite(&Ndel, 1, 4, fp) != 4
+         || fwrite(Delmap, 1, (Ndel + 7) / 8, fp) != (Ndel + 7) / 8) {
+         fclose(fp);
+         bail("Cannot write txclean.del");
       }
-      /* Otherwise the block transaction is not in txclean.dat.
-       * (Maybe the block is foreign.)
-       */
-   }  /* end for j < Ntx */
-   fclose(fp);      /* txclean.dat */
-   fclose(fpout);   /* txq.tmp temp file */
-   fclose(bfp);     /* block */
-   if(bcount > get32(bt.tcount))
-      bail("Bad tcount in new block");  /* should never happen! */
-   unlink("txclean.dat");
-   rename("txq.tmp", "txclean.dat");    /* clean TX queue is updated */
-   if(Trace) plog("bup.c: wrote %u entries to new txclean.dat", nout);
+      fclose(fp);
+   }
+   if(Trace) plog("bup.c: marked %ld of %u entries in txclean.dat",
+                  nmark, Ndel);
 
 noclean:
+   br_close(&Br);
 
    /***** Update ledger by applying ltran.dat to ledger.dat *****
     *
@@ -249,6 +422,8 @@ noclean:
    if(fp == NULL) bail("Cannot open ltran.dat");
    fpout = fopen("ledger.tmp", "wb");
    if(fpout == NULL) bail("Cannot open ledger.tmp");
+   /* At the end of an Eon, write the neo-genesis block as we go. */
+   if(bt.bnum[0] == 0xff) ngopen();
 
    debug("reading tran 1");  /* debug */
    count = fread(&lt, 1, sizeof(LTRAN), fp);  /* read a transaction */
@@ -321,7 +496,7 @@ write2:
             if(Trace > 1) plog("bup.c: Writing new balance to %s...",
                                addr2str(newle.addr));   /* debug */
             /* write new balance to temp file */
-            count  = fwrite(&newle, 1, sizeof(LENTRY), fpout);
+            count  = lwrite(&newle, fpout);
             if(count != sizeof(LENTRY)) bail("bad write on temp file 2");
             nout++;  /* count output records */
          } else {
@@ -336,7 +511,7 @@ write2:
       } else if((cond < 0 || teof) && leof == 0) {
          if(Trace > 1) plog("l < t: write old ledger 1");
          /* write the old ledger entry to temp file */
-         count  = fwrite(&oldle, 1, sizeof(LENTRY), fpout);
+         count  = lwrite(&oldle, fpout);
          if(count != sizeof(LENTRY)) bail("bad write on temp file 1");
          nout++;  /* count records in temp file */
          goto read_ledger;  /* read next ledger entry */
@@ -356,12 +531,24 @@ write2:
    }  /* end while not both on EOF  -- updating ledger */
 
    fclose(fp);
+   if(fflush(fpout) != 0 || fsync(fileno(fpout)) != 0)
+      bail("bad write on temp file 3");
    fclose(fpout);
    fclose(lfp);
+   ngclose(&bt, nout);
    if(nout) {
-      /* if there are entries in ledger.tmp */
-      unlink("ledger.dat");
-      rename("ledger.tmp", "ledger.dat");
+      /* if there are entries in ledger.tmp,
+       * journal the update, then swap in the new ledger
+       * keeping the old one as ledger.bak for roll back.
+       */
+      if(write_jnl(&bt) != VEOK) bail("Cannot write update.jnl");
+      unlink("ledger.bak");
+      if(link("ledger.dat", "ledger.bak") != 0)
+         bail("Cannot link ledger.bak");
+      if(rename("ledger.tmp", "ledger.dat") != 0)
+         bail("Cannot rename ledger.tmp");
+      if(syncdir(".") != VEOK)  /* the link and rename are on disk */
+         bail("Cannot sync ledger.dat directory");
       unlink("ltran.dat");   /* may need to archive this */
    } else {
       unlink("ledger.tmp");  /* remove empty temp file */
@@ -374,7 +561,7 @@ write2:
 
    if(rename(argv[1], argv[2]) != 0) bail("rename failed");  /* fail */
 
-   /* malloc'd indexes for sorttx() freed on exit */
+   /* malloc'd indexes for sorttx() and txmark() freed on exit */
 
    return 0;        /* success */
 }  /* end main() */
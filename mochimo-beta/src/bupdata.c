@@ -31,18 +31,20 @@ int bupdata(void)
    word32 time1;
    BTRAILER bt;
 
+   if(readtrailer(&bt, "ublock.dat") != VEOK)
+      ecode = error("bupdata(): cannot read new ublock.dat hash");
+   pthread_mutex_lock(&Tipmutex);  /* for sendtx() in workers */
    if(add64(Cblocknum, One, Cblocknum)) /* increment block number */
       ecode = error("new blocknum overflow");
 
    /* Update block hashes */
    memcpy(Prevhash, Cblockhash, HASHLEN);
-   if(readtrailer(&bt, "ublock.dat") != VEOK)
-      ecode = error("bupdata(): cannot read new ublock.dat hash");
    memcpy(Cblockhash, bt.bhash, HASHLEN);
    Difficulty = get32(bt.difficulty);
    Time0 = get32(bt.time0);
    time1 = get32(bt.stime);
    add_weight(Weight, Difficulty);
+   pthread_mutex_unlock(&Tipmutex);
    /* Update block difficulty */
    Difficulty = set_difficulty(Difficulty, time1 - Time0);
    if(Trace) {
@@ -56,10 +58,14 @@ int bupdata(void)
 }  /* end bupdata() */
 
 
-/* Build a neo-genesis block -- called from server.c */
+/* Build a neo-genesis block -- called from server.c
+ * bup leaves ngblock.tmp when it wrote the block in the same pass
+ * as the ledger; otherwise neogen builds it from ledger.dat.
+ */
 int do_neogen(void)
 {
    char cmd[1024];
+   char ngname[100];
    int len;
    word32 newnum[2];
    char *cp;
@@ -67,25 +73,39 @@ int do_neogen(void)
    BTRAILER bt;
 
    unlink("neofail.lck");
+   add64(Cblocknum, One, newnum);
+   sprintf(ngname, "%s/b%s.bc", Bcdir, bnum2hex((byte *) newnum));
+   if(exists("ngblock.tmp")
+      && readtrailer(&bt, "ngblock.tmp") == VEOK
+      && memcmp(bt.phash, Cblockhash, HASHLEN) == 0
+      && memcmp(bt.bnum, newnum, 8) == 0) {
+      if(Trace) plog("do_neogen(): using ngblock.tmp from bup");
+      if(rename("ngblock.tmp", ngname) != 0)
+         return error("do_neogen(): cannot move ngblock.tmp");
+      if(append_tfile(ngname, "tfile.dat") != VEOK)
+         return error("do_neogen(): cannot append tfile.dat");
+      goto done;
+   }
+   unlink("ngblock.tmp");
    cp = bnum2hex(Cblocknum);
    sprintf(cmd, "../neogen %s/b%s.bc", Bcdir, cp);
    len = strlen(cmd);
-   add64(Cblocknum, One, newnum);
-   cp = bnum2hex((byte *) newnum);
-   sprintf(&cmd[len], " %s/b%s.bc", Bcdir, cp);
+   sprintf(&cmd[len], " %s", ngname);
    if(Trace) plog("Creating neo-genesis block:\n '%s'", cmd);
    ecode = system(cmd);
    if(Trace) plog("do_neogen(): system():  ecode = %d", ecode);
    if(exists("neofail.lck"))
       return error("do_neogen failed");
-   sprintf(cmd, "%s/b%s.bc", Bcdir, cp);
 
+done:
+   if(readtrailer(&bt, ngname) != VEOK)
+      return error("do_neogen(): cannot read NG block hash");
+   pthread_mutex_lock(&Tipmutex);
    add64(Cblocknum, One, Cblocknum);
    /* Update block hashes */
    memcpy(Prevhash, Cblockhash, HASHLEN);
-   if(readtrailer(&bt, cmd) != VEOK)
-      return error("do_neogen(): cannot read NG block hash");
    memcpy(Cblockhash, bt.bhash, HASHLEN);
+   pthread_mutex_unlock(&Tipmutex);
    Eon++;
    return VEOK;
 }
@@ -40,6 +40,7 @@ char *trigg_check(byte *in, byte d, byte *bnum);
 
 #define EXCLUDE_RESOLVE
 #include "tag.c"
+#include "blockrd.c"
 
 word32 Tnum = -1;    /* transaction sequence number */
 char *Bvaldelfname;  /* set == argv[1] to delete input file on failure */
@@ -82,8 +83,8 @@ int main(int argc, char **argv)
 {
    BHEADER bh;             /* fixed length block header */
    static BTRAILER bt;     /* block trailer */
-   static TXQENTRY tx;     /* Holds one transaction in the array */
-   FILE *fp;               /* to read block file */
+   TXQENTRY *tx;           /* points to one transaction in the array */
+   static BLOCKRD br;      /* mapped block file */
    FILE *ltfp;             /* ledger transaction output file ltran.tmp */
    word32 hdrlen, tcount;  /* header length and transaction count */
    int cond;
@@ -98,7 +99,6 @@ int main(int argc, char **argv)
    static SHA256_CTX mctx;  /* to hash transaction array */
    word32 bnum[2], stemp;
    static word32 mfees[2], mreward[2];
-   unsigned long blocklen;
    int count;
    static byte do_rename = 1;
    static byte pk2[WOTSSIGBYTES], message[32], rnd2[32];  /* for WOTS */
@@ -143,28 +143,21 @@ int main(int argc, char **argv)
    ltfp = fopen("ltran.tmp", "wb");
    if(ltfp == NULL) bail("Cannot create ltran.tmp");
 
-   /* open the block to validate */
-   fp = fopen(argv[1], "rb");
-   if(!fp) {
-badread:
-      bail("Cannot read input rblock.dat");
-   }
-   if(fread(&hdrlen, 1, 4, fp) != 4) goto badread;  /* read header length */
+   /* map the block to validate and check its lengths */
+   cond = br_open(&br, argv[1]);
+   if(cond == VERROR) bail("Cannot read input rblock.dat");
+   if(cond == VEBAD2) baddrop("bad bt.tcount");
+   if(cond != VEOK) drop("bad block length");
+   hdrlen = br.hdrlen;
    /* regular fixed size block header */
    if(hdrlen != sizeof(BHEADER))
       drop("bad hdrlen");
 
-   /* compute block file length */
-   if(fseek(fp, 0, SEEK_END)) goto badread;
-   blocklen = ftell(fp);
-
    /* Read block trailer:
     * Check phash, bnum,
     * difficulty, Merkel Root, nonce, solve time, and block hash.
     */
-   if(fseek(fp, -(sizeof(BTRAILER)), SEEK_END)) goto badread;
-   if(fread(&bt, 1, sizeof(BTRAILER), fp) != sizeof(BTRAILER))
-      drop("bad trailer read");
+   memcpy(&bt, br.bt, sizeof(BTRAILER));
    if(memcmp(Mfee, bt.mfee, 8) != 0)
       drop("bad mining fee");
    if(get32(bt.difficulty) != Difficulty)
@@ -185,15 +178,11 @@ badread:
    printf("\n%s\n\n", haiku);
 
    /* Read block header */
-   if(fseek(fp, 0, SEEK_SET)) goto badread;
-   if(fread(&bh, 1, hdrlen, fp) != hdrlen)
-      drop("short header read");
+   memcpy(&bh, br.bh, sizeof(BHEADER));
    get_mreward(mreward, bnum);
    if(memcmp(bh.mreward, mreward, 8) != 0)
       drop("bad mining reward");
 
-   /* fp left at offset of Merkel Block Array--ready to fread() */
-
    sha256_init(&bctx);   /* begin entire block hash */
    sha256_update(&bctx, (byte *) &bh, hdrlen);  /* ... with the header */
 
@@ -203,8 +192,6 @@ badread:
    tcount = get32(bt.tcount);
    if(tcount == 0 || tcount > MAXBLTX)
       baddrop("bad bt.tcount");
-   if((hdrlen + sizeof(BTRAILER) + (tcount * sizeof(TXQENTRY))) != blocklen)
-      drop("bad block length");
 
    /* Now ready to read transactions */
    sha256_init(&mctx);   /* begin Merkel Array hash */
@@ -213,22 +200,20 @@ badread:
    for(Tnum = 0; Tnum < tcount; Tnum++) {
       if(Tnum >= MAXBLTX)
          drop("too many TX's");
-      if(fread(&tx, 1, sizeof(TXQENTRY), fp) != sizeof(TXQENTRY))
-         drop("bad TX read");
-      if(   memcmp(tx.src_addr, tx.dst_addr, TXADDRLEN) == 0
-         || memcmp(tx.src_addr, tx.chg_addr, TXADDRLEN) == 0)
+      tx = br_tx(&br, Tnum);
+      if(tx == NULL) drop("bad TX read");
+      if(   memcmp(tx->src_addr, tx->dst_addr, TXADDRLEN) == 0
+         || memcmp(tx->src_addr, tx->chg_addr, TXADDRLEN) == 0)
                drop("src_addr matched dst or chg");
 
-      if(memcmp(Mfee, tx.tx_fee, 8) != 0)
+      if(memcmp(Mfee, tx->tx_fee, 8) != 0)
          drop("tx_fee is bad");   /* fixed fee */
 
-      /* running block hash */
-      sha256_update(&bctx, (byte *) &tx, sizeof(TXQENTRY));
-      /* running Merkel hash */
-      sha256_update(&mctx, (byte *) &tx, sizeof(TXQENTRY));
-      /* tx_id is hash of tx.src_add */
-      sha256(tx.src_addr, TXADDRLEN, tx_id);
-      if(memcmp(tx_id, tx.tx_id, HASHLEN) != 0)
+      /* running block hash and Merkel hash in one pass */
+      sha256_update2(&bctx, &mctx, (byte *) tx, sizeof(TXQENTRY));
+      /* tx_id is hash of tx->src_add */
+      sha256(tx->src_addr, TXADDRLEN, tx_id);
+      if(memcmp(tx_id, tx->tx_id, HASHLEN) != 0)
          drop("bad TX_ID");
 
       /* Check that tx_id is sorted. */
@@ -241,44 +226,44 @@ badread:
       memcpy(prev_tx_id, tx_id, HASHLEN);
 
       /* check WTOS signature */
-      sha256(tx.src_addr, SIG_HASH_COUNT, message);
-      memcpy(rnd2, &tx.src_addr[TXSIGLEN+32], 32);  /* copy WOTS addr[] */
-      wots_pk_from_sig(pk2, tx.tx_sig, message, &tx.src_addr[TXSIGLEN],
+      sha256(tx->src_addr, SIG_HASH_COUNT, message);
+      memcpy(rnd2, &tx->src_addr[TXSIGLEN+32], 32);  /* copy WOTS addr[] */
+      wots_pk_from_sig(pk2, tx->tx_sig, message, &tx->src_addr[TXSIGLEN],
                        (word32 *) rnd2);
-      if(memcmp(pk2, tx.src_addr, TXSIGLEN) != 0)
+      if(memcmp(pk2, tx->src_addr, TXSIGLEN) != 0)
          baddrop("WOTS signature failed!");
 
       /* look up source address in ledger */
-      if(le_find(tx.src_addr, &src_le, NULL) == FALSE)
+      if(le_find(tx->src_addr, &src_le, NULL) == FALSE)
          drop("src_addr not in ledger");
 
       total[0] = total[1] = 0;
       /* use add64() to check for carry out */
-      cond =  add64(tx.send_total, tx.change_total, total);
-      cond += add64(tx.tx_fee, total, total);
+      cond =  add64(tx->send_total, tx->change_total, total);
+      cond += add64(tx->tx_fee, total, total);
       if(cond) drop("total overflow");
 
       if(memcmp(src_le.balance, total, 8) < 0)  /* !=  @ */
          drop("bad transaction total");
 
-      if(tag_valid(tx.src_addr, tx.chg_addr) != VEOK)
+      if(tag_valid(tx->src_addr, tx->chg_addr) != VEOK)
          drop("tag not valid");
 
       /* Write ledger transaction to ltran.tmp '-' first */
-      fwrite(tx.src_addr,    1, TXADDRLEN, ltfp);
+      fwrite(tx->src_addr,    1, TXADDRLEN, ltfp);
       fwrite("-",            1,         1, ltfp);  /* zero src addr */
       fwrite(&total,         1,         8, ltfp);
       /* add to or create dst address */
-      if(!iszero(tx.send_total, 8)) {
-         fwrite(tx.dst_addr,   1, TXADDRLEN, ltfp);
+      if(!iszero(tx->send_total, 8)) {
+         fwrite(tx->dst_addr,   1, TXADDRLEN, ltfp);
          fwrite("+",           1,         1, ltfp);
-         fwrite(tx.send_total, 1,         8, ltfp);
+         fwrite(tx->send_total, 1,         8, ltfp);
       }
       /* add to or create change address */
-      if(!iszero(tx.change_total, 8)) {
-         fwrite(tx.chg_addr,     1, TXADDRLEN, ltfp);
+      if(!iszero(tx->change_total, 8)) {
+         fwrite(tx->chg_addr,     1, TXADDRLEN, ltfp);
          fwrite("+",             1,         1, ltfp);
-         fwrite(tx.change_total, 1,         8, ltfp);
+         fwrite(tx->change_total, 1,         8, ltfp);
       }
 
       if(add64(mfees, Mfee, mfees)) {
@@ -310,7 +295,7 @@ fee_overflow:
 
    le_close();
    fclose(ltfp);
-   fclose(fp);
+   br_close(&br);
    rename("ltran.tmp", "ltran.dat");
    unlink("vblock.dat");
    if(do_rename)
@@ -74,6 +74,9 @@ void put64(void *buff, void *val)
    ((word32 *) buff)[1] = ((word32 *) val)[1];
 }
 
+#include "blockrd.c"
+
+BLOCKRD Br;  /* the block in Bfp, mapped */
 
 /* Prototypes */
 char *trigg_check(byte *in, byte d, byte *bnum);
@@ -184,33 +187,15 @@ void disp_taddr(byte *addr)
 }
 
 
-/* Seek to end of fname and read block trailer.
- * Return 0 on success, else error code.
- * fp is open and stays open.
- */
-int readtrailer2(BTRAILER *trailer, FILE *fp)
-{
-
-   if(fseek(fp, -(sizeof(BTRAILER)), SEEK_END) != 0) {
-bad:
-      printf("Cannot read block trailer\n");
-      return 1;
-   }
-   if(fread(trailer, 1, sizeof(BTRAILER), fp) != sizeof(BTRAILER))
-      goto bad;
-   return 0;
-}
-
-
 /* Return 0 on success.
  * Non-NULL filename over-rides bnum.
  */
 int read_block(word32 bnum, BHEADER *bh, BTRAILER *bt, char *filename)
 {
    char fnamebuff[100], *fname;
-   int count;
    static byte bnum8[8];
 
+   br_close(&Br);
    if(Bfp) fclose(Bfp);
    if(filename) fname = filename;
    else {
@@ -224,21 +209,17 @@ int read_block(word32 bnum, BHEADER *bh, BTRAILER *bt, char *filename)
       return 1;
    }
    Bnum = bnum;
-   count = fread(&Hdrlen, 1, 4, Bfp);
-   if(count != 4) {
-err:
+   if(br_open(&Br, fname) != VEOK) {
       printf("Error reading %s\n", fname);
       fclose(Bfp);
       Bfp = NULL;
       return 2;
    }
+   Hdrlen = Br.hdrlen;
    memset(bh, 0, sizeof(BHEADER));
    put32(bh->hdrlen, Hdrlen);
-   if(Hdrlen == sizeof(BHEADER) && Bnum != 0) {
-      fseek(Bfp, 0, SEEK_SET);
-      if(fread(bh, 1, sizeof(BHEADER), Bfp) != sizeof(BHEADER))
-         goto err;
-   }
+   if(Br.bh && Bnum != 0)
+      memcpy(bh, Br.bh, sizeof(BHEADER));
    if(Bnum == 0) printf("%s is the Genesis Block.\n\n", fname);
    else {
       if((Bnum & 255) == 0)
@@ -246,7 +227,7 @@ err:
                 fname, (int) ((get32(bh->hdrlen) - 4) / sizeof(LENTRY)));
    }
 
-   if(readtrailer2(bt, Bfp) != 0) goto err;
+   memcpy(bt, Br.bt, sizeof(BTRAILER));
    return 0;  /* success */
 }  /* end read_block() */
 
@@ -764,7 +745,7 @@ readb:
 int txmenu(BHEADER *bh, BTRAILER *bt)
 {
    char buff[80];
-   TXQENTRY txq;
+   TXQENTRY *txq;
    word32 j;
 
    CLEARSCR();
@@ -782,21 +763,21 @@ int txmenu(BHEADER *bh, BTRAILER *bt)
 
    for( ;; ) {
       CLEARSCR();
-      fseek(Bfp, (sizeof(TXQENTRY) * Txidx) + get32(bh->hdrlen), SEEK_SET);
-      fread(&txq, 1, sizeof(TXQENTRY), Bfp);
+      txq = br_tx(&Br, Txidx);
+      if(txq == NULL) return 1;
       printf("Transactions in block %u (0x%x)\n\n", Bnum, Bnum);
 
       printf("Tx index:   %d\n", Txidx);
-      printf("Tx id:      0x");  bytes2hex(txq.tx_id, 32);
-      printf("src_addr:   0x");  disp_taddr(txq.src_addr);
-      printf("dst_addr:   0x");  disp_taddr(txq.dst_addr);
-      printf("chg_addr:   0x");  disp_taddr(txq.chg_addr);
-      printf("send total:   %s", itoa64lj(txq.send_total, NULL, 9, 1));
-      printf("  [0x%s]\n", b2hex8(txq.send_total));
-      printf("change total: %s", itoa64lj(txq.change_total, NULL, 9, 1));
-      printf("  [0x%s]\n", b2hex8(txq.change_total));
-      printf("fee:          %s\n", itoa64lj(txq.tx_fee, NULL, 9, 1));
-      printf("sig:        0x");  bytes2hex(txq.tx_sig, 32);
+      printf("Tx id:      0x");  bytes2hex(txq->tx_id, 32);
+      printf("src_addr:   0x");  disp_taddr(txq->src_addr);
+      printf("dst_addr:   0x");  disp_taddr(txq->dst_addr);
+      printf("chg_addr:   0x");  disp_taddr(txq->chg_addr);
+      printf("send total:   %s", itoa64lj(txq->send_total, NULL, 9, 1));
+      printf("  [0x%s]\n", b2hex8(txq->send_total));
+      printf("change total: %s", itoa64lj(txq->change_total, NULL, 9, 1));
+      printf("  [0x%s]\n", b2hex8(txq->change_total));
+      printf("fee:          %s\n", itoa64lj(txq->tx_fee, NULL, 9, 1));
+      printf("sig:        0x");  bytes2hex(txq->tx_sig, 32);
 
       printf("\nq=quit, g=goto TX, RETURN=next, b=back, "
              "p=previous menu: "
@@ -15,57 +15,83 @@
  */
 int rx2(NODE *np, int checkids, int seconds)
 {
-   int count, n;
-   time_t timeout;
+   int count, len;
    TX *tx;
 
    tx = &np->tx;
-   timeout = time(NULL) + seconds;
 
    if(Trace)
       plog("Entering rx() sd = %d  id1 = %x  id2 = %x",
            np->sd, np->id1, np->id2); /* debug */
 
-   for(n = 0; ; ) {
-      count = recv(np->sd, TXBUFF(tx) + n, TXBUFFLEN - n, 0);
-      if(count == 0) return VERROR;
-      if(count < 0) {
-         if(time(NULL) >= timeout) return VETIMEOUT;
-         usleep(10);
-         continue;
-      }
-      n += count;
-      if(n == TXBUFFLEN) break;
-   }  /* end for */
+   count = recvall(np->sd, TXBUFF(tx), FRAMELEN, seconds);
+   if(count != VEOK) return count;  /* VERROR or VETIMEOUT */
+   /* OP_HELLO_ACK is a v2 frame if she is version 2 */
+   if(np->v2 || V2FRAMES(tx->version[0])) {
+      if((len = framelen(tx)) == 0) return VEBAD;
+      count = recvall(np->sd, TXBUFF(tx) + FRAMELEN, len - FRAMELEN,
+                      seconds);
+      if(count != VEOK) return count;
+      if(unframe(tx) != VEOK) return VEBAD;
+      np->v2 = 1;
+   } else {
+      count = recvall(np->sd, TXBUFF(tx) + FRAMELEN, TXBUFFLEN - FRAMELEN,
+                      seconds);
+      if(count != VEOK) return count;
+      if(crc16(CRC_BUFF(tx), CRC_COUNT) != get16(tx->crc16))
+         return VEBAD;
+   }
 
    /* check tx and return error codes or count */
    if(get16(tx->network) != TXNETWORK)
       return VEBAD;
    if(get16(tx->trailer) != TXEOT)
       return VEBAD;
-   if(crc16(CRC_BUFF(tx), CRC_COUNT) != get16(tx->crc16))
-      return VEBAD;
    if(checkids && (np->id1 != get16(tx->id1) || np->id2 != get16(tx->id2)))
       return VEBAD;
    return VEOK;  /* 0 success */
 }  /* end rx2() */
 
 
+/* ID tokens for any thread: rand16() shares one seed, so each
+ * thread draws from its own rand2r() seed, set on first use.
+ */
+static __thread word32 Tseed[3];
+
+word32 rand16t(void)
+{
+   if(Tseed[0] == 0) {
+      Tseed[0] = ((word32) time(NULL) ^ (word32) pthread_self()) | 1;
+      Tseed[1] = (word32) (unsigned long) Tseed;  /* per thread */
+      Tseed[2] = (word32) getpid();
+   }
+   return rand2r(Tseed);
+}
+
+
 /* Call peer and complete Three-Way */
 int callserver(NODE *np, word32 ip)
+{
+   return callserver2(np, ip, ACK_TIMEOUT);
+}
+
+
+/* callserver() that waits no more than seconds for OP_HELLO_ACK */
+int callserver2(NODE *np, word32 ip, int seconds)
 {
    int ecode;
+   char ipstr[16];
 
-   if(Trace) plog("callserver(): Trying %s...", ntoa((byte *) &ip));
+   if(Trace) plog("callserver(): Trying %s...", ntoa2((byte *) &ip, ipstr));
 
    memset(np, 0, sizeof(NODE));   /* clear structure */
    np->sd = connectip(ip);  /* returns non-blocked sd */
    if(np->sd == INVALID_SOCKET) return VERROR;
    np->src_ip = ip;
-   np->id1 = rand16();
+   np->id1 = rand16t();
    if(send_op(np, OP_HELLO) != VEOK) goto bad;
 
-   ecode = rx2(np, 0, ACK_TIMEOUT);
+   ecode = rx2(np, 0, seconds);
    if(ecode != VEOK) {
       if(Trace) plog("   *** missing HELLO_ACK packet (%d)", ecode);
 bad:
@@ -75,14 +101,17 @@ bad:
    }
    np->id2 = get16(np->tx.id2);
    np->opcode = get16(np->tx.opcode);
+   np->caps = np->tx.version[1];
    if(np->opcode != OP_HELLO_ACK || get16(np->tx.id1) != np->id1) {
       printf("   *** HELLO_ACK is wrong: %d", np->opcode);
-      pinklist(ip);   /* protocol violator! */
-      epinklist(ip);
+      if(!inworker()) {  /* lists belong to server() */
+         pinklist(ip);   /* protocol violator! */
+         epinklist(ip);
+      }
       goto bad;
    }
    return VEOK;
-}  /* end callserver() */
+}  /* end callserver2() */
 
 
 /* Used for opcode = OP_GETHAL or OP_GETIPL
@@ -105,9 +134,57 @@ int get_tx2(NODE *np, word32 ip, word16 opcode)
 }  /* end get_tx2() */
 
 
+/* Read the reply to OP_GET_BULK for block bnum from np into fp: one
+ * OP_SEND_BULK packet, then send_total bytes that must hash to the
+ * SHA-256 at the start of src_addr.  send_total may be no more than
+ * MAXBLEN, or MAXNGLEN for a neo-genesis block.
+ * Returns VEOK or VERROR.
+ */
+int rx_bulk(NODE *np, byte *bnum, FILE *fp)
+{
+   SHA256_CTX ctx;
+   byte hash[HASHLEN];
+   byte *buff;
+   size_t len, n, count;
+   int ecode;
+
+   if((ecode = rx2(np, 1, 10)) != VEOK) return VERROR;
+   if(get16(np->tx.opcode) != OP_SEND_BULK) return VERROR;
+   len = get32(np->tx.send_total);
+   if(get32(np->tx.send_total + 4) != 0 || len < sizeof(BTRAILER)
+      || len > (bnum[0] == 0 ? MAXNGLEN : MAXBLEN)) {
+      if(Trace) plog("rx_bulk(): bad length %lu", (unsigned long) len);
+      return VERROR;
+   }
+   buff = malloc(BULKBUFF);
+   if(buff == NULL) return error("rx_bulk(): no memory");
+   setvbuf(fp, NULL, _IOFBF, 16 * BULKBUFF);
+   sha256_init(&ctx);
+   for(n = 0; n < len; n += count) {
+      count = len - n < BULKBUFF ? len - n : BULKBUFF;
+      if(recvall(np->sd, buff, (int) count, 10) != VEOK) goto bad;
+      sha256_update(&ctx, buff, (unsigned) count);
+      if(fwrite(buff, 1, count, fp) != count) {
+         error("rx_bulk() I/O error");
+         goto bad;
+      }
+   }
+   free(buff);
+   sha256_final(&ctx, hash);
+   if(memcmp(hash, TRANBUFF(&np->tx), HASHLEN) != 0) {
+      if(Trace) plog("rx_bulk(): bad hash");
+      return VERROR;
+   }
+   return VEOK;
+bad:
+   free(buff);
+   return VERROR;
+}  /* end rx_bulk() */
+
+
 /* Get a block or other file from peer, ip.
- * opcode is OP_GETBLOCK or OP_GET_TFILE.
- * bnum can be NULL for OP_GET_FILE.
+ * opcode is OP_GETBLOCK, OP_GET_TFILE, or OP_GET_TRAILERS from
+ * bnum on.  bnum can be NULL for OP_GET_FILE.
  * Returns VEOK (0) on good download, else VERROR (1).
  */
 int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode)
@@ -130,6 +207,19 @@ int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode)
    
    /* set request block number */
    if(bnum) put64(node.tx.blocknum, bnum);
+   if(opcode == OP_GET_TRAILERS && !(node.caps & C_TFILE)) goto bad;
+   if(opcode == OP_GETBLOCK && (node.caps & C_BULK)) {
+      /* peer sends the whole block after one packet */
+      if(send_op(&node, OP_GET_BULK) != VEOK) goto bad;
+      if((ecode = rx_bulk(&node, bnum, fp)) != VEOK) goto bad;
+      if(fclose(fp) != 0) {
+         fp = NULL;
+         goto bad;
+      }
+      closesocket(node.sd);
+      if(Trace) plog("get_block2(): bulk EOF");
+      return VEOK;
+   }
    if(send_op(&node, opcode) != VEOK) goto bad;
    for(;;) {
       if((ecode = rx2(&node, 1, 10)) != VEOK) goto bad;
@@ -153,7 +243,7 @@ int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode)
       } /* end if EOF */
    }  /* end for */
 bad:
-   fclose(fp);
+   if(fp) fclose(fp);
    unlink(fname);  /* delete partial downloads */
    if(node.sd != INVALID_SOCKET)
       closesocket(node.sd);
@@ -36,28 +36,54 @@
 
 /* Version checking */
 #ifndef PVERSION
-#define PVERSION      1      /* protocol version number (short) */
+#define PVERSION      2      /* protocol version number (short) */
 #endif
+#define PCAPS  (C_BULK | C_STREAM | C_INV | C_BALS | C_TFILE)  /* version[1] */
 
 /* Adjustable Parameters */
 #define MAXNODES      37       /* maximum number of connected nodes  */
-#define LQLEN         100      /* listen() queue length              */
+#define LQLEN         1024     /* listen() queue length              */
+#define MAXCONN       4096     /* half-open connections in server()  */
+#define NWORKER       16       /* threads to execute() requests      */
+#define MAXJOBS       512      /* requests queued or in execute()    */
+#define BULKBUFF      65536    /* recv() size for OP_SEND_BULK data  */
+#define BULKCACHE     16       /* block hashes kept by send_bulk()   */
+#define MAXNGLEN      0x80000000UL  /* most bytes in a neo-genesis block */
 #define INIT_TIMEOUT  3        /* initial timeout after accept()     */
+#define STREAM_TIMEOUT 60      /* idle C_STREAM connection timeout   */
 #define ACK_TIMEOUT   10       /* timeout in callserver()            */
 #define TXQUEBIG      32       /* big enough to run bcon             */
 #define MAXBLTX       32768    /* max TX's in a block for bcon (~1M) */
 #define STATUSFREQ    10       /* status display interval sec.       */
 #define BCDIR         "bc"     /* rename to dir for block storage    */
-#define CPINKLEN     100       /* maximum entries in pinklists       */
-#define LPINKLEN     100
-#define EPINKLEN     100
+#define LOCALSOCK     "mochimo.sock"  /* local query socket: local.c  */
+#define IPTABLEN     65536     /* IP's in pink.c table, power of 2   */
+#define IPWAYS       8         /* slots an IP may hash to            */
+#define CONNRATE     16        /* connections per second per IP      */
+#define CONNBURST    256
+#define OPRATE       100       /* requests per second per IP         */
+#define OPBURST      1000
+#define GETRATE      256       /* block fetches per second per IP    */
+#define GETBURST     4096
 #define EPOCHMASK     15       /* update pinklist Epoch count - 1    */
 #define EPOCHSHIFT    4
 #define RPLISTLEN     200      /* recent peer list */
 #define CPLISTLEN     8        /* current peer list */
-#define CRCLISTLEN    1024     /* recent tx crc's */
+#define TXIDLEN       262144   /* tx_id filter slots, power of 2     */
+#define TXIDPROBE     32       /* most slots looked at per tx_id     */
+#define TXIDAGE       600      /* seconds per tx_id filter generation */
+#define INVWAIT       10       /* seconds to wait for a TX we asked for */
 #define LULL          30       /* seconds between doubt */
 #define MAXQUORUM     8        /* for get_eon() gang[] */
+#define SESSLEN       256      /* peer sessions in session.c         */
+#define MIRRORTHREADS 8        /* threads mirror() sends with        */
+#define MQLEN         1024     /* TX's queued for mirror()           */
+#define FOUNDTHREADS  16       /* peers send_found() calls at once   */
+#define FOUND_TIMEOUT 4        /* seconds send_found() gives a peer  */
+#define MAXMINERS     64       /* most threads miner() solves with   */
+#define SYNCWIN       32       /* blocks get_eon() fetches ahead     */
+#define TFBACK        64       /* our trailers get_eon() fetches again */
+#define TFTHREADS     8        /* most threads tfval() checks with  */
 
 #ifdef DEBUG
 /* was 15, 7, and 5 in v.22 */
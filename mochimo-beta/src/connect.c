@@ -11,7 +11,7 @@ SOCKET connectip(word32 ip)
    SOCKET sd;
    struct sockaddr_in addr;
    word16 port;
-   time_t timeout;
+   long long timeout;
 
    if((sd = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET) {
 bad:
@@ -27,12 +27,13 @@ bad:
    addr.sin_port = htons(port);
 
    nonblock(sd);  /* was after connect() v.21 */
-   timeout = time(NULL) + 3;
+   timeout = mstime() + 3000;
 retry:
    if(connect(sd, (struct sockaddr *) &addr, sizeof(struct sockaddr))) {
       if(errno == EISCONN) return sd;
+      /* wait for writable, then connect() again for the result */
       if((errno == EINPROGRESS || errno == EALREADY)
-         && time(NULL) < timeout) goto retry;
+         && sock_wait(sd, POLLOUT, timeout) == VEOK) goto retry;
       closesocket(sd);
       if(Trace) plog("connectip(): cannot connect(0x%08x):%d.", ip, port);
       return INVALID_SOCKET;
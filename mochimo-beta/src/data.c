@@ -17,11 +17,11 @@ byte Running;        /* non-zero when server is online            */
 byte Errorlog;       /* non-zero to log errors to "error.log"     */
 byte Monitor;        /* set non-zero by ctrlc() to enter monitor  */
 byte Bgflag;         /* ignore ctrl-c Monitor and no term output  */
-word32 Dynasleep;    /* sleep usec. per loop if Nonline < 1       */
+word32 Dynasleep;    /* longest ev_wait() usec. per loop, or 0    */
 word32 Trace;        /* non-zero plog()  trace log                */
-int Nonline;         /* number of pid's in Nodes[]                */
+int Nonline;         /* requests queued or in execute()           */
 word32 Nbadlogs;     /* total bad login attempts                  */
-word32 Nspace;       /* Node[] table full count                   */
+word32 Nspace;       /* request queue full count                  */
 word32 Nlogins;      /* total logins since boot                   */
 word32 Ntimeouts;    /* total client timeouts                     */
 word32 Nrec;         /* total TX received                         */
@@ -46,15 +46,15 @@ word16 Dstport;          /* Our send destination port */
 char *Bcdir = BCDIR;     /* block chain directory */
 
 #ifndef EXCLUDE_NODES
-NODE Nodes[MAXNODES];  /* data structure for connected NODE's     */
-NODE *Hi_node = Nodes; /* points one beyond last logged in NODE   */
-
 word32 Rplist[RPLISTLEN];  /* recent peer list */
 word32 Rplistidx;
 word32 Cplist[CPLISTLEN];  /* current peer list */
 word32 Cplistidx;
-word32 Crclist[CRCLISTLEN];  /* crc's of recent TX's */
-word32 Crclistidx;
+word64 Txidkey[2][TXIDLEN];   /* tx_id filter, two generations */
+time_t Txidtime[2][TXIDLEN];  /* when asked for in OP_GETDATA, or 0 */
+int Txidgen;                  /* current generation */
+word32 Txidcount;             /* entries in it */
+time_t Txidstart;             /* when it began */
 
 #define CORELISTLEN 8
 #if CORELISTLEN > RPLISTLEN || CORELISTLEN > CPLISTLEN
@@ -72,7 +72,7 @@ byte Ininit;            /* non-zero when init() runs */
 byte Safemode;          /* Safe mode enable */
 byte Betabait;          /* betabait() display */
 
-#endif  /* !EXCLUDE_NODES Nodes[] and ip data */
+#endif  /* !EXCLUDE_NODES ip data */
 
 word32 Mfee[2] = { 500, 0 };  /* mining fee */
 byte Maddr[TXADDRLEN];        /* mining address read by bcon and bval */
@@ -86,7 +86,6 @@ byte Weight[HASHLEN];
 
 /* lock files    writes   reads     deletes
  * txq1.lck      gomochi            gomochi
- * mq.lck        gomochi            gomochi
  * neofail.lck   neogen   bupdata   bupdata
  * ufail.lck     bup                gomochi
  * vbad.lck      bval               bval
@@ -101,7 +100,7 @@ byte Needcleanup;         /* set true when Winsock is started */
 char *Corefname = "coreip.lst";  /* Master ip list by main() */
 pid_t Bcpid;              /* bcon process id */
 byte Bcbnum[8];           /* Cblocknum at time of execl bcon */
-pid_t Sendfound_pid;
+byte Sendfound;           /* send_found() thread started */
+byte Foundstop;           /* and should stop */
 pid_t Mpid;               /* miner */
-pid_t Mqpid;              /* mirror() */
-int Mqcount;              /* count of mq.dat records */
+int Nminers = 1;          /* its threads: -m, 0 = one per CPU */
@@ -112,7 +112,6 @@ int stop_miner(void)
 void fatal2(int exitcode, char *message)
 {
    stop_miner();
-   if(Sendfound_pid) kill(Sendfound_pid, SIGTERM);
 #ifndef EXCLUDE_NODES
    stop_mirror();
 #endif
@@ -131,6 +130,11 @@ void fatal2(int exitcode, char *message)
 #define fatal(mess) fatal2(0, mess)
 #define pause_server() fatal2(0, NULL);
 
+/* Exit with code 2: the run scripts discard local state and
+ * begin again from the Genesis Block.
+ */
+#define resync(mess) fatal2(2, mess)
+
 void restart(char *mess)
 {
    stop_miner();
@@ -0,0 +1,420 @@
+/* evloop.c  Event loop for server()
+ *
+ * Copyright (c) 2018 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.TXT   **** NO WARRANTY ****
+ *
+ * The Mochimo Project System Software
+ *
+ * Date: 19 October 2026
+ *
+ * One epoll descriptor (poll() where there is no epoll) watches the
+ * listening socket, a pipe written on SIGCHLD, and every half-open
+ * connection.  Each connection is read as the data arrives:
+ *
+ *    CS_HELLO   read OP_HELLO      gethello() sends OP_HELLO_ACK
+ *    CS_OP      read the request   gettx(), then serve() in server.c
+ *
+ * with INIT_TIMEOUT seconds allowed for each packet.  A peer with
+ * C_STREAM in her OP_HELLO goes back to CS_OP after each request that
+ * is answered here, and may wait STREAM_TIMEOUT seconds to send the
+ * next one.  See session.c.  If her OP_HELLO is version 2, requests
+ * after it are v2 frames (types.h), read one frame at a time.
+ * Connections on the local query socket are in CS_LOCAL from the
+ * start and answered by local_query() in local.c.
+ * server() sleeps in ev_wait() until there is work to do.
+*/
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#define CS_HELLO  0     /* reading OP_HELLO */
+#define CS_OP     1     /* reading request after OP_HELLO_ACK */
+#define CS_LOCAL  2     /* reading a local query: see local.c */
+
+#define EVTICK    1000  /* longest ev_wait() in milliseconds */
+#define EV_LSD    0     /* event tags: listening socket */
+#define EV_SIG    1     /* SIGCHLD pipe */
+#define EV_USD    2     /* local query socket */
+#define EV_CONN   3     /* Conn[tag - EV_CONN] */
+
+/* A half-open connection */
+typedef struct {
+   NODE node;        /* sd, src_ip, and tx being read */
+   int n;            /* bytes of node.tx read so far */
+   int state;        /* CS_HELLO, CS_OP, or CS_LOCAL */
+   byte *lq;         /* CS_LOCAL request: LQHDR + LQMAXLEN bytes */
+   int reqs;         /* requests read after OP_HELLO */
+   time_t timeout;   /* drop the connection after this time */
+} CONN;
+
+CONN *Conn[MAXCONN];   /* malloc'd on accept() */
+int Nconn;             /* Conn[] in use */
+int Hiconn;            /* one past highest Conn[] in use */
+SOCKET Evlsd = INVALID_SOCKET;  /* listening socket */
+SOCKET Evusd = INVALID_SOCKET;  /* local query socket */
+byte Lsdoff;           /* accept() paused: Conn[] or descriptors full */
+int Sigpipe[2] = { -1, -1 };
+#ifdef __linux__
+int Evfd = -1;         /* epoll descriptor */
+#endif
+
+
+void sigchld(int sig)
+{
+   int save;
+
+   save = errno;
+   write(Sigpipe[1], "c", 1);  /* wake ev_wait() */
+   errno = save;
+}
+
+
+/* Wake ev_wait() from another thread. */
+void ev_wake(void)
+{
+   if(Sigpipe[1] >= 0) write(Sigpipe[1], "w", 1);
+}
+
+
+#ifdef __linux__
+int ev_ctl(int op, int fd, word32 tag)
+{
+   struct epoll_event ev;
+
+   memset(&ev, 0, sizeof(ev));
+   ev.events = EPOLLIN;
+   ev.data.u32 = tag;
+   return epoll_ctl(Evfd, op, fd, &ev);
+}
+#endif
+
+
+/* Pause accept() on both sockets until a connection closes. */
+void lsd_off(void)
+{
+   if(Lsdoff) return;
+#ifdef __linux__
+   ev_ctl(EPOLL_CTL_DEL, Evlsd, EV_LSD);
+   if(Evusd != INVALID_SOCKET) ev_ctl(EPOLL_CTL_DEL, Evusd, EV_USD);
+#endif
+   Lsdoff = 1;
+}
+
+
+void lsd_on(void)
+{
+   if(!Lsdoff || Nconn >= MAXCONN) return;
+#ifdef __linux__
+   ev_ctl(EPOLL_CTL_ADD, Evlsd, EV_LSD);
+   if(Evusd != INVALID_SOCKET) ev_ctl(EPOLL_CTL_ADD, Evusd, EV_USD);
+#endif
+   Lsdoff = 0;
+}
+
+
+/* Remove Conn[k] from the loop and return it to the caller to free.
+ * The socket is left open.
+ */
+CONN *conn_take(int k)
+{
+   CONN *c;
+
+   c = Conn[k];
+#ifdef __linux__
+   /* A fork()'ed child may share the socket: close() alone
+    * would not remove it from the epoll set.
+    */
+   ev_ctl(EPOLL_CTL_DEL, c->node.sd, EV_CONN + k);
+#endif
+   Conn[k] = NULL;
+   Nconn--;
+   while(Hiconn > 0 && Conn[Hiconn - 1] == NULL) Hiconn--;
+   lsd_on();
+   return c;
+}
+
+
+void conn_close(int k)
+{
+   CONN *c;
+
+   c = conn_take(k);
+   closesocket(c->node.sd);
+   free(c->lq);
+   free(c);
+}
+
+
+/* Accept new connections on the listening socket, or the local
+ * query socket if local is non-zero, while there are any.
+ */
+void conn_accept(int local)
+{
+   SOCKET sd;
+   CONN *c;
+   word32 ip;
+   int k;
+
+   while(Nconn < MAXCONN) {
+      sd = accept(local ? Evusd : Evlsd, NULL, NULL);
+      if(sd == INVALID_SOCKET) {
+         if(errno == EMFILE || errno == ENFILE) {
+            if(Trace) plog("conn_accept(): out of descriptors");
+            lsd_off();
+         }
+         return;
+      }
+      ip = local ? 0 : getsocketip(sd);  /* uses getpeername() */
+      /*
+       * There are many ways to be bad...
+       * Check pink lists...
+       */
+      if(!local && (pinklisted(ip) || !ipallow(ip, IP_CONN))) {
+         statinc(&Nbadlogs);
+         closesocket(sd);
+         continue;
+      }
+      for(k = 0; k < MAXCONN && Conn[k]; k++);
+      c = calloc(1, sizeof(CONN));
+      if(c != NULL && local
+         && (c->lq = malloc(LQHDR + LQMAXLEN)) == NULL) {
+         free(c);
+         c = NULL;
+      }
+      if(c == NULL) {
+         closesocket(sd);
+         lsd_off();
+         return;
+      }
+      nonblock(sd);
+      c->node.sd = sd;
+      c->node.src_ip = ip;
+      c->state = local ? CS_LOCAL : CS_HELLO;
+      c->timeout = Ltime + INIT_TIMEOUT;
+#ifdef __linux__
+      if(ev_ctl(EPOLL_CTL_ADD, sd, EV_CONN + k) != 0) {
+         closesocket(sd);
+         free(c->lq);
+         free(c);
+         continue;
+      }
+#endif
+      Conn[k] = c;
+      Nconn++;
+      if(k >= Hiconn) Hiconn = k + 1;
+   }
+   lsd_off();  /* Conn[] full */
+}  /* end conn_accept() */
+
+
+/* Read what Conn[k] has sent and move her along. */
+void conn_read(int k)
+{
+   CONN *c;
+   NODE *np, node;
+   byte *buf;
+   int count, status, len, op, kind;
+
+   c = Conn[k];
+   np = &c->node;
+   buf = c->state == CS_LOCAL ? c->lq : TXBUFF(&np->tx);
+   for(;;) {
+      len = TXBUFFLEN;
+      if(c->state == CS_LOCAL) {
+         len = LQHDR;
+         if(c->n >= LQHDR
+            && (len = LQHDR + get16(buf + 2)) > LQHDR + LQMAXLEN)
+            break;
+      } else if(np->v2 && c->state == CS_OP) {
+         /* read no further than her frame: more may follow */
+         len = FRAMELEN;
+         if(c->n >= FRAMELEN && (len = framelen(&np->tx)) == 0) break;
+      }
+      if(c->n < len) {
+         count = recv(np->sd, buf + c->n, len - c->n, 0);
+         if(count == 0) break;  /* connection reset */
+         if(count < 0) {
+            if(errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR)
+               return;  /* wait for more */
+            break;
+         }
+         c->n += count;
+         continue;  /* collect the full TX */
+      }
+      if(c->state == CS_HELLO) {
+         if(gethello(np) != VEOK) break;
+         c->state = CS_OP;
+         c->n = 0;
+         c->timeout = Ltime + INIT_TIMEOUT;
+         continue;
+      }
+      if(c->state == CS_LOCAL) {
+         if(local_query(np->sd, buf) != VEOK) break;
+         c->n = 0;
+         c->timeout = Ltime + STREAM_TIMEOUT;
+         continue;
+      }
+      /* request is in: finish it in the parent or a child */
+      if(np->v2 && unframe(&np->tx) != VEOK) { statinc(&Nbadlogs);  break; }
+      /* a block fetch is rated on its own: see pink.c */
+      op = get16(np->tx.opcode);
+      kind = (op == OP_GETBLOCK || op == OP_GET_BULK || op == OP_GET_TFILE
+              || op == OP_GET_TRAILERS) ? IP_GET : IP_OP;
+      if(kind == IP_GET && c->reqs == 0) iprefund(np->src_ip);
+      c->reqs++;
+      if(!ipallow(np->src_ip, kind)) { statinc(&Nbadlogs);  break; }
+      status = gettx(np);
+      if((np->caps & C_STREAM) && (status == 1
+         || (status == sizeof(TX) && np->opcode == OP_FOUND))) {
+         if(status != 1) {
+            /* worker fetches the block on her own connection */
+            memcpy(&node, np, sizeof(NODE));
+            node.sd = INVALID_SOCKET;
+            serve(&node, status);
+         }
+         c->n = 0;  /* keep the stream for her next request */
+         c->timeout = Ltime + STREAM_TIMEOUT;
+         continue;
+      }
+      c = conn_take(k);
+      serve(&c->node, status);
+      free(c);
+      return;
+   }
+   conn_close(k);
+}  /* end conn_read() */
+
+
+/* Drop connections that are too slow. */
+void ev_expire(void)
+{
+   int k;
+
+   for(k = 0; k < Hiconn; k++) {
+      if(Conn[k] == NULL || Ltime <= Conn[k]->timeout) continue;
+      Ntimeouts++;  /* log statistics */
+      conn_close(k);
+   }
+   lsd_on();  /* retry accept() if it ran out of descriptors */
+}
+
+
+/* Start the event loop on listening socket lsd.
+ * Returns VEOK or VERROR.
+ */
+int ev_open(SOCKET lsd)
+{
+   struct sigaction sa;
+
+   Evlsd = lsd;
+   if(pipe(Sigpipe) != 0) return VERROR;
+   nonblock(Sigpipe[0]);
+   nonblock(Sigpipe[1]);
+   /* keep them out of bcon and friends */
+   fcntl(Sigpipe[0], F_SETFD, FD_CLOEXEC);
+   fcntl(Sigpipe[1], F_SETFD, FD_CLOEXEC);
+#ifdef __linux__
+   Evfd = epoll_create1(EPOLL_CLOEXEC);
+   if(Evfd < 0) return VERROR;
+   if(ev_ctl(EPOLL_CTL_ADD, lsd, EV_LSD) != 0
+      || ev_ctl(EPOLL_CTL_ADD, Sigpipe[0], EV_SIG) != 0) return VERROR;
+#endif
+   Evusd = local_open(LOCALSOCK);
+   if(Evusd == INVALID_SOCKET) error("Cannot open %s", LOCALSOCK);
+#ifdef __linux__
+   else if(ev_ctl(EPOLL_CTL_ADD, Evusd, EV_USD) != 0) {
+      closesocket(Evusd);
+      Evusd = INVALID_SOCKET;
+      unlink(LOCALSOCK);
+   }
+#endif
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = sigchld;
+   sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGCHLD, &sa, NULL);
+   return VEOK;
+}  /* end ev_open() */
+
+
+void ev_close(void)
+{
+   int k;
+
+   signal(SIGCHLD, SIG_DFL);  /* so waitpid() works */
+   for(k = 0; k < Hiconn; k++)
+      if(Conn[k]) conn_close(k);
+#ifdef __linux__
+   if(Evfd >= 0) close(Evfd);
+   Evfd = -1;
+#endif
+   if(Evusd != INVALID_SOCKET) {
+      closesocket(Evusd);
+      unlink(LOCALSOCK);
+   }
+   Evusd = INVALID_SOCKET;
+   if(Sigpipe[0] >= 0) { close(Sigpipe[0]); close(Sigpipe[1]); }
+   Sigpipe[0] = Sigpipe[1] = -1;
+}
+
+
+/* Wait up to msec milliseconds (EVTICK at most) for connections,
+ * packets, or a child to exit, and handle them.
+ * Returns the number of events.
+ */
+int ev_wait(int msec)
+{
+   char buff[64];
+   word32 tag;
+   int j, n;
+#ifdef __linux__
+   static struct epoll_event ev[64];
+#else
+   static struct pollfd fds[MAXCONN + 3];
+   static word32 tags[MAXCONN + 3];
+   int k;
+#endif
+
+   if(msec < 0 || msec > EVTICK) msec = EVTICK;
+#ifdef __linux__
+   n = epoll_wait(Evfd, ev, 64, msec);
+#else
+   n = 0;
+   fds[n].fd = Sigpipe[0];  tags[n++] = EV_SIG;
+   if(!Lsdoff) { fds[n].fd = Evlsd;  tags[n++] = EV_LSD; }
+   if(!Lsdoff && Evusd != INVALID_SOCKET) {
+      fds[n].fd = Evusd;
+      tags[n++] = EV_USD;
+   }
+   for(k = 0; k < Hiconn; k++) {
+      if(Conn[k] == NULL) continue;
+      fds[n].fd = Conn[k]->node.sd;
+      tags[n++] = EV_CONN + k;
+   }
+   for(j = 0; j < n; j++) fds[j].events = POLLIN;
+   n = poll(fds, n, msec);
+#endif
+   if(n <= 0) return 0;  /* timeout or signal */
+   Ltime = time(NULL);
+#ifdef __linux__
+   for(j = 0; j < n; j++) {
+      tag = ev[j].data.u32;
+#else
+   for(j = 0, k = n; k > 0; j++) {
+      if(fds[j].revents == 0) continue;
+      k--;
+      tag = tags[j];
+#endif
+      if(tag == EV_SIG) {
+         while(read(Sigpipe[0], buff, sizeof(buff)) > 0);
+      } else if(tag == EV_LSD) {
+         if(!Lsdoff) conn_accept(0);
+      } else if(tag == EV_USD) {
+         if(!Lsdoff) conn_accept(1);
+      } else if(Conn[tag - EV_CONN]) conn_read(tag - EV_CONN);
+   }
+   return n;
+}  /* end ev_wait() */
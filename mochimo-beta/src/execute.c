@@ -41,22 +41,67 @@ int send_balance(NODE *np)
 }  /* end send_balance() */
 
 
-int sendnack(NODE *np)
+/* Answer OP_BALANCES from np with OP_SEND_BALS.
+ * Called from gettx() OP_BALANCES
+ * on entry:
+ *     np->tx.len          bytes of keys: BALKEYLEN per address
+ *     TRANBUFF(&np->tx)   first BALKEYLEN bytes of each address
+ * on return:
+ *     np->tx.len          TXAMOUNT + HASHLEN + 1 per address
+ *     TRANBUFF(&np->tx)   their balances, in the same order, then the
+ *                         HASHLEN hash of each matched address, then a
+ *                         BAL_NONE, BAL_ONE, or BAL_MANY byte for each:
+ *                         see le_balances().
+ *
+ * Returns 1 on I/O errors, else 0.
+ */
+int send_balances(NODE *np)
 {
-   put16(np->tx.opcode, OP_NACK);
-   return sendtx(np);
-}
+   byte bal[BALSLEN * TXAMOUNT], hash[BALSLEN * HASHLEN], found[BALSLEN];
+   int lockfd, n, status;
+
+   n = get16(np->tx.len) / BALKEYLEN;
+   if(n > BALSLEN) n = BALSLEN;
+   /* lock TX file once for the lot */
+   lockfd = lock("txq1.lck", 20);
+   if(lockfd == -1) {
+      error("send_balances() cannot lock txq1.lck");
+      return 1;
+   }
+   status = le_balances(TRANBUFF(&np->tx), n, bal, hash, found);
+   unlock(lockfd);
+   if(status != VEOK) return 1;
+   memset(TRANBUFF(&np->tx), 0, TRANLEN);
+   memcpy(TRANBUFF(&np->tx), bal, n * TXAMOUNT);
+   memcpy(TRANBUFF(&np->tx) + n * TXAMOUNT, hash, n * HASHLEN);
+   memcpy(TRANBUFF(&np->tx) + n * (TXAMOUNT + HASHLEN), found, n);
+   put16(np->tx.len, n * (TXAMOUNT + HASHLEN + 1));
+   send_op(np, OP_SEND_BALS);
+   return 0;
+}  /* end send_balances() */
 
 
-/*
- * send_file() timeout handler  -- child exits
+/* Put the name of block bnum in Bcdir into fname[100].
+ * For worker threads: bnum2hex() is not for threads.
  */
-void sendalrm(int sig)
+void bcname(char *fname, byte *bnum)
 {
-   exit(1);  /* fail */
+   sprintf(fname, "%s/b%02x%02x%02x%02x%02x%02x%02x%02x.bc", Bcdir,
+           bnum[7], bnum[6], bnum[5], bnum[4],
+           bnum[3], bnum[2], bnum[1], bnum[0]);
 }
 
-/* Send block to peer  -- called by child
+
+int sendnack(NODE *np)
+{
+   put16(np->tx.opcode, OP_NACK);
+   return sendtx(np);
+}
+
+
+/* Send block to peer  -- called by a worker thread
+ * For OP_GET_TRAILERS, send fname from trailer tx->blocknum on.
+ * Each packet gets sendtx()'s timeout.
  * Return VERROR on file errors or reset connection, else VEOK.
  */
 int send_file(NODE *np, char *fname)
@@ -70,10 +115,8 @@ int send_file(NODE *np, char *fname)
    tx = &np->tx;
    bnum = tx->blocknum;
 
-   show("send");
-
    if(fname == NULL) {
-      sprintf(name, "%s/b%s.bc", Bcdir, bnum2hex(bnum));
+      bcname(name, bnum);
       fname = name;
    }
    fp = fopen(fname, "rb");
@@ -82,27 +125,117 @@ int send_file(NODE *np, char *fname)
       sendnack(np);
       return VERROR;
    }
+   if(np->opcode == OP_GET_TRAILERS) {
+      if(get32(bnum + 4) != 0 || fseek(fp, (long) get32(bnum)
+         * sizeof(BTRAILER), SEEK_SET) != 0) {
+         fclose(fp);
+         sendnack(np);
+         return VERROR;
+      }
+   }
    if(Trace) plog("sending %s", fname);
-   blocking(np->sd);   /* set blocking I/O for send() */
-   signal(SIGALRM, sendalrm);  /* set timeout handler */
    for(; Running; ) {
       n = fread(TRANBUFF(tx), 1, TRANLEN, fp);
       put16(tx->len, n);
-      alarm(10);
       status = send_op(np, OP_SEND_BL);
       if(n < TRANLEN) {
-         alarm(0);
          fclose(fp);
-         return status;  /* VEOK or VERROR -- server does freeslot() */
+         return status;  /* VEOK or VERROR */
       }
       if(status != VEOK) break;
    }  /* end for(; Running; ) */
-   alarm(0);
    fclose(fp);
    return VERROR;
 }  /* end send_file() */
 
 
+/* Block hashes for send_bulk(), so that asking again for a large
+ * block does not hash it again.  An entry is good while the file has
+ * the same inode, length, and mtime.
+ */
+typedef struct {
+   byte bnum[8];
+   ino_t ino;
+   off_t len;
+   time_t mtime;
+   byte hash[HASHLEN];
+} BULKHASH;
+
+BULKHASH Bulkhash[BULKCACHE];
+int Bulknext;
+pthread_mutex_t Bulkmutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Put the SHA-256 of block bnum, open in br, in hash[]. */
+void bulk_hash(BLOCKRD *br, byte *bnum, byte *hash)
+{
+   SHA256_CTX ctx;
+   BULKHASH *bp;
+   struct stat st;
+   int j, ok;
+
+   ok = fstat(br->fd, &st) == 0;
+   if(ok) {
+      pthread_mutex_lock(&Bulkmutex);
+      for(j = 0; j < BULKCACHE; j++) {
+         bp = &Bulkhash[j];
+         if(memcmp(bp->bnum, bnum, 8) == 0 && bp->ino == st.st_ino
+            && bp->len == st.st_size && bp->mtime == st.st_mtime) {
+            memcpy(hash, bp->hash, HASHLEN);
+            pthread_mutex_unlock(&Bulkmutex);
+            return;
+         }
+      }
+      pthread_mutex_unlock(&Bulkmutex);
+   }
+   sha256_init(&ctx);
+   sha256_update(&ctx, br->map, (unsigned) br->len);
+   sha256_final(&ctx, hash);
+   if(ok) {
+      pthread_mutex_lock(&Bulkmutex);
+      bp = &Bulkhash[Bulknext];
+      Bulknext = (Bulknext + 1) % BULKCACHE;
+      memcpy(bp->bnum, bnum, 8);
+      bp->ino = st.st_ino;
+      bp->len = st.st_size;
+      bp->mtime = st.st_mtime;
+      memcpy(bp->hash, hash, HASHLEN);
+      pthread_mutex_unlock(&Bulkmutex);
+   }
+}  /* end bulk_hash() */
+
+
+/* Send block np->tx.blocknum to a C_BULK peer in reply to OP_GET_BULK:
+ * one OP_SEND_BULK packet with the file length in send_total and its
+ * SHA-256 at the start of src_addr, then the file itself by sendfd().
+ * Return VERROR on file errors or reset connection, else VEOK.
+ */
+int send_bulk(NODE *np)
+{
+   BLOCKRD br;
+   TX *tx;
+   char fname[100];
+   int status;
+
+   tx = &np->tx;
+   bcname(fname, tx->blocknum);
+   if(br_open(&br, fname) != VEOK) {
+      if(Trace) plog("cannot open %s", fname);
+      sendnack(np);
+      return VERROR;
+   }
+   if(Trace) plog("sending %s in bulk", fname);
+   memset(TRANBUFF(tx), 0, TRANLEN);
+   put32(tx->send_total, (word32) br.len);
+   put32(tx->send_total + 4, (word32) (br.len >> 16 >> 16));
+   bulk_hash(&br, tx->blocknum, TRANBUFF(tx));
+   status = send_op(np, OP_SEND_BULK);
+   if(status == VEOK) status = sendfd(np->sd, br.fd, br.len, 10);
+   br_close(&br);
+   return status == VEOK ? VEOK : VERROR;
+}  /* end send_bulk() */
+
+
 /* Send our recent peer list to NODE np in response to OP_GETIPL.
  * Called from execute().
  */
@@ -116,9 +249,32 @@ int send_ipl(NODE *np)
 }
 
 
+/* Answer OP_INV from NODE np with OP_GETDATA listing the
+ * tx_id's we have not seen.  Called from gettx().
+ */
+int send_getdata(NODE *np)
+{
+   byte *in, *out;
+   int len;
+
+   len = get16(np->tx.len);
+   if(len > INVLEN * HASHLEN) len = 0;
+   in = out = TRANBUFF(&np->tx);
+   for( ; len >= HASHLEN; in += HASHLEN, len -= HASHLEN) {
+      if(recenttxid(in)) { statinc(&Ndups);  continue; }
+      addtxid(in, Ltime);  /* others need not send it */
+      if(out != in) memcpy(out, in, HASHLEN);
+      out += HASHLEN;
+   }
+   put16(np->tx.len, out - TRANBUFF(&np->tx));
+   return send_op(np, OP_GETDATA);
+}
+
+
 /**
- * Called from server()  --  NOTE: we are in child here
- * Returns 0 = Aokay! Veronica says child is done.
+ * Called from worker() in pool.c  --  NOTE: not the server() thread,
+ * so leave the peer and pink lists alone.
+ * Returns 0 = Aokay! Veronica says job is done.
  *         1 = there were issues
  *         2 = pinklist
  *         3 = and epinklist too!
@@ -130,13 +286,14 @@ int execute(NODE *np)
    if(Trace)
       plog("execute(): opcode = %d", np->opcode);
 
-   status = 0;  /* for child exit status */
+   status = 0;  /* for pool_done() */
    switch(np->opcode) {
       case OP_FOUND:
          /* get the advertised found block -- synchronous
           * Blockfound was set by gettx()
           */
-         closesocket(np->sd);  /* close initial connection */
+         if(np->sd != INVALID_SOCKET)
+            closesocket(np->sd);  /* close initial connection */
          if(get_block2(np->src_ip, np->tx.cblock, "rblock.dat",
                        OP_GETBLOCK) != VEOK) return 1;  /* fail */
          return 0;
@@ -145,14 +302,20 @@ int execute(NODE *np)
          if(send_file(np, NULL) != VEOK) status = 1;
          closesocket(np->sd);
          return status;
+      case OP_GET_BULK:
+         /* send np->tx.blocknum to peer in one piece */
+         if(send_bulk(np) != VEOK) status = 1;
+         closesocket(np->sd);
+         return status;
       case OP_GET_TFILE:
-         /* send out tfile.dat to peer */
+      case OP_GET_TRAILERS:
+         /* send out tfile.dat, or its tail, to peer */
          if(send_file(np, "tfile.dat") != VEOK) status = 1;
          closesocket(np->sd);
          return status;
 
       default:
-         Nbadlogs++;  /* bad OP's */
+         statinc(&Nbadlogs);  /* bad OP's */
          if(Trace) plog("execute(): bad opcode: %d", np->opcode);
          return 2;
     }  /* end switch op */
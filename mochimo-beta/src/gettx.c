@@ -6,30 +6,22 @@
  * Date: 2 January 2018
 */
 
+/* Held to change or copy Cblocknum, Cblockhash, Prevhash, and Weight
+ * while worker threads may be sending.
+ */
+pthread_mutex_t Tipmutex = PTHREAD_MUTEX_INITIALIZER;
 
-/* forward reference */
-int rx2(NODE *np, int checkids, int seconds);
+/* Held to count Nsenderr, Nbadlogs, and Ndups from any thread. */
+pthread_mutex_t Statmutex = PTHREAD_MUTEX_INITIALIZER;
 
-/* Mark NODE np in Nodes[] empty by setting np->pid to zero.
- * Adjust Nonline and Hi_node.
- * Caller must close np->sd if needed.
- */
-int freeslot(NODE *np)
+
+/* Add one to statistics counter *cp. */
+void statinc(word32 *cp)
 {
-   if(np->pid == 0)
-      return error("*** NODE %ld already called freeslot() ***",
-                   (long) (np - Nodes));
-   if(Trace)
-      plog("freeslot(): idx=%d  ip = %-1.20s pid = %d", (long) (np - Nodes),
-           ntoa((byte *) &np->src_ip), np->pid);
-   Nonline--;
-   np->pid = 0;
-   /* Update pointer to just beyond highest used slot in Nodes[] */
-   while(Hi_node > Nodes && (Hi_node - 1)->pid == 0)
-      Hi_node--;
-   if(Nonline < 0) { Nonline = 0; return error("Nonline < 0"); }
-   return VEOK;
-}  /* end freeslot() */
+   pthread_mutex_lock(&Statmutex);
+   (*cp)++;
+   pthread_mutex_unlock(&Statmutex);
+}
 
 
 /* Send packet: set advertised fields and crc16.
@@ -37,42 +29,49 @@ int freeslot(NODE *np)
  */
 int sendtx(NODE *np)
 {
-   int count, len;
-   time_t timeout;
-   byte *buff;
+   return sendtx2(np, NULL, NULL, NULL);
+}
+
+
+/* Send np->tx as though our block were bnum with hash bhash
+ * and previous hash phash, or as our current block if bnum is NULL.
+ */
+int sendtx2(NODE *np, byte *bnum, byte *bhash, byte *phash)
+{
+   byte frame[TXBUFFLEN];
+   int count;
 
-   put16(np->tx.version, PVERSION);
+   np->tx.version[0] = PVERSION;
+   np->tx.version[1] = PCAPS;
    put16(np->tx.network, TXNETWORK);
    put16(np->tx.trailer, TXEOT);
 
    put16(np->tx.id1, np->id1);
    put16(np->tx.id2, np->id2);
-   put64(np->tx.cblock, Cblocknum);  /* 64-bit little-endian */
-   memcpy(np->tx.cblockhash, Cblockhash, HASHLEN);
-   memcpy(np->tx.pblockhash, Prevhash, HASHLEN);
+   pthread_mutex_lock(&Tipmutex);  /* all from one block */
+   if(bnum == NULL) {
+      bnum = Cblocknum;
+      bhash = Cblockhash;
+      phash = Prevhash;
+   }
+   put64(np->tx.cblock, bnum);  /* 64-bit little-endian */
+   memcpy(np->tx.cblockhash, bhash, HASHLEN);
+   memcpy(np->tx.pblockhash, phash, HASHLEN);
    if(get16(np->tx.opcode) != OP_TX)  /* do not copy over TX ip map */
       memcpy(np->tx.weight, Weight, HASHLEN);
-   crctx(&np->tx);
-   count = send(np->sd, TXBUFF(&np->tx), TXBUFFLEN, 0);
-   if(count == TXBUFFLEN) return VEOK;
-   /* --- v20 retry */
-   if(Trace) plog("sendtx(): send() retry...");
-   timeout = time(NULL) + 10;
-   for(len = TXBUFFLEN, buff = TXBUFF(&np->tx); ; ) {
-      if(count == 0) break;
-      if(count > 0) { buff += count; len -= count; }
-      else {
-         if(errno != EWOULDBLOCK || time(NULL) >= timeout) break;
-      }
-      count = send(np->sd, buff, len, 0);
-      if(count == len) return VEOK;
+   pthread_mutex_unlock(&Tipmutex);
+   /* --- v20 retry: now waits in poll() */
+   if(np->v2) count = sendall(np->sd, frame, frametx(&np->tx, frame), 10);
+   else {
+      crctx(&np->tx);
+      count = sendall(np->sd, TXBUFF(&np->tx), TXBUFFLEN, 10);
    }
-   /* --- v20 end */
-   Nsenderr++;
+   if(count == VEOK) return VEOK;
+   statinc(&Nsenderr);
    if(Trace)
-      plog("send() error: count = %d  errno = %d", count, errno);
+      plog("send() error: status = %d  errno = %d", count, errno);
    return VERROR;
-}  /* end sendtx() */
+}  /* end sendtx2() */
 
 
 int send_op(NODE *np, int opcode)
@@ -159,84 +158,81 @@ void clear_contention(void)
 
 /* opcodes in types.h */
 #define valid_op(op)  ((op) >= FIRST_OP && (op) <= LAST_OP)
-#define crowded(op)   (Nonline > (MAXNODES - 5) && (op) != OP_FOUND)
-#define can_fork_tx() (Nonline <= (MAXNODES - 5))
+#define crowded(op)   (Nonline > (MAXJOBS - 5) && (op) != OP_FOUND)
+#define can_fork_tx() (Nonline <= (MAXJOBS - 5))
 
 /**
- * Listen gettx()   (still in parent)
- * Reads a TX structure from SOCKET sd.  Handles 3-way and 
- * validates crc and id's.  Also cares for requests that do not need
- * a child process.
+ * Listen gethello()   (still in parent)
+ * Checks the first packet read from a new connection np by
+ * ev_wait() in evloop.c, and answers OP_HELLO with OP_HELLO_ACK.
  *
  * Returns:
- *          -1 no data yet
- *          0 connection reset
- *          sizeof(TX) to create child NODE to process read np->tx
- *          1 to close connection ("You're done, tx")
+ *          VEOK to go on and read the request with gettx()
+ *          1 to close connection (bad packet or send error)
  *          2 src_ip was pinklisted (She was very naughty.)
- *
- * On entry: sd is non-blocking.
- *
- * Op sequence: OP_HELLO,OP_HELLO_ACK,OP_(?x)
  */
-int gettx(NODE *np, SOCKET sd)
+int gethello(NODE *np)
 {
-   int count, status, n;
-   word16 opcode;
    TX *tx;
-   word32 crc, ip;
-   time_t timeout;
 
    tx = &np->tx;
-   memset(np, 0, sizeof(NODE));  /* clear structure */
-   np->sd = sd;
-   np->src_ip = ip = getsocketip(sd);  /* uses getpeername() */
-
-   /*
-    * There are many ways to be bad...
-    * Check pink lists...
-    */
-   if(pinklisted(ip)) {
-      Nbadlogs++;
-      return 2;
-   }
-
-   n = recv(sd, TXBUFF(tx), TXBUFFLEN, 0);
-   if(n <= 0) return n;
-   timeout = time(NULL) + 3;
-   for( ; n != TXBUFFLEN; ) {
-      count = recv(sd, TXBUFF(tx) + n, TXBUFFLEN - n, 0);
-      if(count == 0) return 1;
-      if(count < 0) {
-         if(time(NULL) >= timeout) { Ntimeouts++; return 1; }
-         continue;
-      }
-      n += count;  /* collect the full TX */
-   }
-   count = n;
-
    /*
     * validate packet and return 1 if bad.
     */
-   opcode = get16(tx->opcode);
    if(get16(tx->network) != TXNETWORK
       || get16(tx->trailer) != TXEOT
       || crc16(CRC_BUFF(tx), CRC_COUNT) != get16(tx->crc16) ) {
-            if(Trace) plog("gettx(): bad packet");
+            if(Trace) plog("gethello(): bad packet");
             return 1;  /* BAD packet */
    }
 
-   if(Trace) plog("gettx(): crc16 good");
-   if(opcode != OP_HELLO) goto bad1;
+   if(Trace) plog("gethello(): crc16 good");
+   if(get16(tx->opcode) != OP_HELLO) {
+      epinklist(np->src_ip);
+      pinklist(np->src_ip);
+      statinc(&Nbadlogs);
+      if(Trace)
+         plog("   gethello(): pinklist(%s) opcode = %d",
+              ntoa((byte *) &np->src_ip), get16(tx->opcode));
+      return 2;
+   }
    np->id1 = get16(tx->id1);
    np->id2 = rand16();
+   np->caps = tx->version[1];
+   np->v2 = V2FRAMES(tx->version[0]);  /* from OP_HELLO_ACK on */
    if(send_op(np, OP_HELLO_ACK) != VEOK) return VERROR;
-   status = rx2(np, 1, 3);
+   return VEOK;
+}  /* end gethello() */
+
+
+/**
+ * Listen gettx()   (still in parent)
+ * Checks the request np->tx read after OP_HELLO_ACK by ev_wait()
+ * and validates crc and id's.  Also cares for requests that do not
+ * need a worker thread.
+ *
+ * Returns:
+ *          sizeof(TX) to have a worker execute() np->tx
+ *          1 to close connection ("You're done, tx")
+ *          2 src_ip was pinklisted (She was very naughty.)
+ *
+ * Op sequence: OP_HELLO,OP_HELLO_ACK,OP_(?x)
+ */
+int gettx(NODE *np)
+{
+   int status;
+   word16 opcode;
+   TX *tx;
+   byte tx_id[HASHLEN];
+
+   tx = &np->tx;
    opcode = get16(tx->opcode);
-   if(Trace)
-      plog("gettx(): got opcode = %d  status = %d", opcode, status);
-   if(status == VEBAD) goto bad2;
-   if(status != VEOK) return VERROR;  /* bad packet -- timeout? */
+   if(Trace) plog("gettx(): got opcode = %d", opcode);
+   if(get16(tx->network) != TXNETWORK
+      || get16(tx->trailer) != TXEOT
+      || (!np->v2 && crc16(CRC_BUFF(tx), CRC_COUNT) != get16(tx->crc16))
+      || np->id1 != get16(tx->id1) || np->id2 != get16(tx->id2))
+         goto bad2;
    np->opcode = opcode;  /* execute() will check the opcode */
    if(!valid_op(opcode)) goto bad1;  /* she was a bad girl */
 
@@ -247,16 +243,19 @@ int gettx(NODE *np, SOCKET sd)
       return 1;  /* You're done! */
    }
    else if(opcode == OP_TX) {
-      /* crc = crc32(TRANBUFF(tx), TRANLEN);  transaction unique? */
-      crc = crc32(tx->src_addr, TXADDRLEN);  /* src_addr unique? */
-      if(recentcrc(crc)) {
-         if(Trace) plog("got dup TX: 0x%08x", crc);
-         Ndups++;
+      sha256(tx->src_addr, TXADDRLEN, tx_id);  /* src_addr unique? */
+      if(havetxid(tx_id)) {
+         if(Trace) plog("got dup TX: 0x%08x", get32(tx_id));
+         statinc(&Ndups);
          return 1;  /* suppress child */
       }
-      addtxcrc(crc);  /* add crc32 to table */
       Nlogins++;  /* raw TX in */
       status = process_tx(np);
+      /* Have it, for the filter and OP_INV, only if it was good.
+       * A bad one counts as asked, so it is not fetched again with
+       * OP_GETDATA for INVWAIT seconds.
+       */
+      addtxid(tx_id, status ? Ltime : 0);
       if(status > 2) goto bad1;
       if(status > 1) goto bad2;
       if(get16(np->tx.len) == 0) {  /* do not add wallets */
@@ -278,68 +277,41 @@ int gettx(NODE *np, SOCKET sd)
          waitpid(Bcpid, NULL, 0);
          Bcpid = 0;
       }
-      if(Sendfound_pid) {
-         kill(Sendfound_pid, SIGTERM);
-         waitpid(Sendfound_pid, NULL, 0);
-         Sendfound_pid = 0;
-      }
+      Foundstop = 1;  /* send_found() can stop early */
       Peerip = np->src_ip;     /* get block child will have this ip */
       /* Now we can fetch the found block, validate it, and update. */
       Blockfound = 1;
-      /* fork() child in sever() */
+      /* worker thread gets it in serve() */
       /* end if OP_FOUND */
+   } else if(opcode == OP_INV) {
+      send_getdata(np);  /* she sends the TX's we want next */
+      return 1;
    } else if(opcode == OP_BALANCE) {
       send_balance(np);
       Nsent++;
       return 1;  /* no child */
+   } else if(opcode == OP_BALANCES) {
+      send_balances(np);
+      Nsent++;
+      return 1;
    } else if(opcode == OP_RESOLVE) {
       tag_resolve(np);
 /*      sendnack(np);  */
       return 1;
    }
 
-   if(opcode == OP_BUSY || opcode == OP_NACK || opcode == OP_HELLO_ACK)
-      return 1;  /* no child needed */
+   if(opcode == OP_BUSY || opcode == OP_NACK || opcode == OP_HELLO_ACK
+      || opcode == OP_GETDATA || opcode == OP_SEND_BALS)
+         return 1;  /* no child needed */
    /* If too many children in too small a space... */
    if(crowded(opcode)) return 1;  /* suppress child unless OP_FOUND */
-   return count;  /* success -- fork() child in server() */
+   return sizeof(TX);  /* success -- worker thread in serve() */
 
 bad1: epinklist(np->src_ip);
 bad2: pinklist(np->src_ip);
-      Nbadlogs++;
+      statinc(&Nbadlogs);
       if(Trace)
          plog("   gettx(): pinklist(%s) opcode = %d",
               ntoa((byte *) &np->src_ip), opcode);
    return 2;
 }  /* end gettx() */
-
-
-/**
- * Is called after initial accept() or connect()
- * Adds the connection to Node[] array.
- * and returns a new NODE * with *np's data.
-*/
-NODE *getslot(NODE *np)
-{
-   NODE *newnp;
-
-   /*
-    * Find empty slot
-    */
-   for(newnp = Nodes; newnp < &Nodes[MAXNODES]; newnp++)
-      if(newnp->pid == 0) break;
-
-   if(newnp >= &Nodes[MAXNODES]) {
-      error("getslot(): Nodes[] full!");
-      Nspace++;
-      return NULL;
-   }
-
-   Nonline++;    /* number of currently connected sockets */
-   if(Trace)
-      plog("getslot() added NODE %d", (int) (newnp - Nodes));
-   if(newnp >= Hi_node)
-      Hi_node = newnp + 1;
-   memcpy(newnp, np, sizeof(NODE));
-   return newnp;
-}  /* end getslot() */
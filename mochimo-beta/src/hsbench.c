@@ -0,0 +1,192 @@
+/* hsbench.c  Handshake benchmark: full packets and v2 frames
+ *
+ * Copyright (c) 2018 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.TXT   **** NO WARRANTY ****
+ *
+ * The Mochimo Project System Software
+ *
+ * Date: 19 October 2026
+ *
+ * Calls a node count times with a version 1 OP_HELLO, then count
+ * times with a version 2 OP_HELLO, and prints handshakes per second
+ * and the bytes each way.  With -b each call also asks OP_BALANCE.
+ * Start the node with -d, or its rate limits will refuse us.
+*/
+
+
+#include "config.h"
+#include "sock.h"
+#include "mochimo.h"
+#include <netinet/tcp.h>
+
+#define EXCLUDE_NODES   /* exclude Nodes[], ip, and socket data */
+#include "data.c"
+
+#include "error.c"
+#include "crc16.c"
+#include "rand.c"
+#include "add64.c"
+#include "util.c"
+
+TX Tx;
+long Sent, Rcvd;  /* bytes */
+
+
+/* Milliseconds on the monotonic clock */
+long long mstime(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+int readall(SOCKET sd, void *buff, int len)
+{
+   int n, count;
+
+   for(n = 0; n < len; n += count) {
+      count = recv(sd, (byte *) buff + n, len - n, 0);
+      if(count <= 0) return VERROR;
+   }
+   Rcvd += len;
+   return VEOK;
+}
+
+
+/* Send Tx as a full packet, or as a v2 frame if v2 is non-zero. */
+int sendpkt(SOCKET sd, int v2)
+{
+   static byte frame[TXBUFFLEN];
+   byte *bp;
+   int len, n, count;
+
+   if(v2) len = frametx(&Tx, bp = frame);
+   else {
+      crctx(&Tx);
+      len = TXBUFFLEN;
+      bp = TXBUFF(&Tx);
+   }
+   for(n = 0; n < len; n += count) {
+      count = send(sd, bp + n, len - n, 0);
+      if(count <= 0) return VERROR;
+   }
+   Sent += len;
+   return VEOK;
+}
+
+
+/* Read a full packet into Tx, or a v2 frame if the node is
+ * version 2 and we said version in our OP_HELLO.
+ */
+int readpkt(SOCKET sd, int version)
+{
+   int len;
+
+   if(readall(sd, &Tx, FRAMELEN) != VEOK) return VERROR;
+   if(version >= 2 && Tx.version[0] >= 2) {
+      if((len = framelen(&Tx)) == 0) return VERROR;
+      if(readall(sd, TXBUFF(&Tx) + FRAMELEN, len - FRAMELEN) != VEOK)
+         return VERROR;
+      return unframe(&Tx);
+   }
+   if(readall(sd, TXBUFF(&Tx) + FRAMELEN, TXBUFFLEN - FRAMELEN) != VEOK)
+      return VERROR;
+   if(crc16(CRC_BUFF(&Tx), CRC_COUNT) != get16(Tx.crc16)) return VEBAD;
+   return VEOK;
+}
+
+
+/* One call with an OP_HELLO of version, and OP_BALANCE if bal. */
+int call(struct sockaddr_in *addr, int version, int bal)
+{
+   SOCKET sd;
+   word16 id1, id2;
+   int on, v2;
+
+   sd = socket(AF_INET, SOCK_STREAM, 0);
+   if(sd == INVALID_SOCKET) return VERROR;
+   on = 1;
+   setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, (char *) &on, sizeof(on));
+   if(connect(sd, (struct sockaddr *) addr, sizeof(*addr)) != 0)
+      goto bad;
+   memset(&Tx, 0, sizeof(TX));
+   Tx.version[0] = version;
+   put16(Tx.network, TXNETWORK);
+   put16(Tx.trailer, TXEOT);
+   put16(Tx.id1, id1 = rand16());
+   put16(Tx.opcode, OP_HELLO);
+   if(sendpkt(sd, 0) != VEOK || readpkt(sd, version) != VEOK) goto bad;
+   if(get16(Tx.opcode) != OP_HELLO_ACK || get16(Tx.id1) != id1) goto bad;
+   v2 = Tx.version[0] >= 2 && version >= 2;
+   if(bal) {
+      id2 = get16(Tx.id2);
+      memset(&Tx, 0, sizeof(TX));
+      Tx.version[0] = version;
+      put16(Tx.network, TXNETWORK);
+      put16(Tx.trailer, TXEOT);
+      put16(Tx.id1, id1);
+      put16(Tx.id2, id2);
+      put16(Tx.opcode, OP_BALANCE);
+      if(sendpkt(sd, v2) != VEOK || readpkt(sd, version) != VEOK)
+         goto bad;
+      if(get16(Tx.opcode) != OP_SEND_BAL) goto bad;
+   }
+   closesocket(sd);
+   return VEOK;
+bad:
+   closesocket(sd);
+   return VERROR;
+}  /* end call() */
+
+
+void usage(void)
+{
+   printf("\nusage: hsbench [-nCOUNT] [-b] host [port]\n"
+          "   -nCOUNT  calls for each version (default 1000)\n"
+          "   -b       ask OP_BALANCE on each call\n\n");
+   exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+   struct sockaddr_in addr;
+   int j, count, bal, version, fails;
+   long long start, ms;
+
+   count = 1000;
+   bal = 0;
+   for(j = 1; j < argc; j++) {
+      if(argv[j][0] != '-') break;
+      switch(argv[j][1]) {
+         case 'n':  count = atoi(&argv[j][2]);
+                    break;
+         case 'b':  bal = 1;
+                    break;
+         default:   usage();
+      }
+   }
+   if(j >= argc || count < 1) usage();
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = inet_addr(argv[j]);
+   addr.sin_port = htons(j + 1 < argc ? atoi(argv[j + 1]) : PORT1);
+   srand16(time(NULL) ^ getpid());
+
+   for(version = 1; version <= 2; version++) {
+      Sent = Rcvd = 0;
+      fails = 0;
+      start = mstime();
+      for(j = 0; j < count; j++)
+         if(call(&addr, version, bal) != VEOK) fails++;
+      ms = mstime() - start;
+      if(ms < 1) ms = 1;
+      printf("v%d: %d calls%s in %lld ms: %.0f/s, %ld bytes out and"
+             " %ld in per call, %d failed\n", version, count,
+             bal ? " with OP_BALANCE" : "", ms, count * 1000.0 / ms,
+             Sent / count, Rcvd / count, fails);
+   }
+   return 0;
+}  /* end main() */
@@ -131,12 +131,21 @@ int read_coreipl(char *fname)
 */
 int get_ipl(NODE *np, word32 ip)
 {
-   int len;
+   int len, status;
    word32 *ipp;
+   NODE *sp;
 
    if(Trace)
-      plog("get_ipl() about to call get_tx2()");
-   if(get_tx2(np, ip, OP_GETIPL) == VEOK) {  /* closes socket */
+      plog("get_ipl() about to call sess_get()");
+   sp = sess_get(ip);
+   if(sp == NULL) return VERROR;
+   put16(sp->tx.len, 0);  /* not a wallet */
+   status = send_op(sp, OP_GETIPL);
+   if(status == VEOK) status = rx2(sp, 1, 10);
+   memcpy(np, sp, sizeof(NODE));
+   np->sd = INVALID_SOCKET;  /* session keeps the socket */
+   sess_put(sp, status);
+   if(status == VEOK) {
       len = get16(np->tx.len);
       if((unsigned) len > TRANLEN) return VEBAD;
       for(ipp = (word32 *) TRANBUFF(&np->tx); len > 0;
@@ -209,66 +218,48 @@ word32 init_coreipl(NODE *np, char *fname)
  */
 int extract(char *fname, char *lfile)
 {
-   word32 hdrlen;    /* to read-in block header length */
-   FILE *fp, *lfp;
-   LENTRY le;        /* buffer to read ledger entry */
-   byte prevaddr[TXADDRLEN];  /* to check block addr sort */
-   byte first;
+   BLOCKRD br;
+   LENTRY *le;       /* ledger entries in the mapped block */
+   word32 j, n;
+   int ecode;
 
    if(Trace) plog("extract() ledger from %s to %s", fname, lfile);
 
-   /* open the neo-genesis block and read in file header length */
-   fp = fopen(fname, "rb");
-   if(!fp) return VERROR;;
-   if(fread(&hdrlen, 1, 4, fp) != 4) goto ioerror;
-
-   lfp = fopen(lfile, "wb");
-   if(!lfp) {
-      error("extract(): Cannot open %s", lfile);
+   /* map the neo-genesis block: br_open() checks its length */
+   ecode = br_open(&br, fname);
+   if(ecode == VERROR) return VERROR;
+   if(ecode != VEOK) {
+      error("extract(): bad neo-genesis block length");
       goto ioerror;
    }
-
    /* Make sure that NG header contains at least
     * one ledger entry.
     */
-   if(hdrlen < (sizeof(LENTRY) + 4)) {
+   if(br.bh != NULL || br.hdrlen < (sizeof(LENTRY) + 4)) {
       error("extract(): Not a neo-genesis block: %s", fname);
-      goto error2;
+      goto ioerror;
    }
 
-   /*
-    * Read the ledger from fp and copy it to lfp,
-    * creating a new ledger.dat file.
-    * NOTE: block trailer must be less than sizeof(LENTRY)
-    */
-   if(fseek(fp, 4, SEEK_SET)) goto error2;
-   for(hdrlen -= 4, first = 1; ; first = 0) {
-      if(fread(&le, 1, sizeof(LENTRY), fp) != sizeof(LENTRY))
-         break;
-      hdrlen -= sizeof(LENTRY);
-      /* check ledger sort in NG block */
-      if(!first && memcmp(le.addr, prevaddr, TXADDRLEN) <= 0) {
+   /* check ledger sort in NG block */
+   le = (LENTRY *) (br.map + 4);
+   n = (br.hdrlen - 4) / sizeof(LENTRY);
+   for(j = 1; j < n; j++) {
+      if(memcmp(le[j].addr, le[j - 1].addr, TXADDRLEN) <= 0) {
          error("extract(): bad ledger sort in neo-genesis block");
-         goto error2;
+         goto ioerror;
       }
-      memcpy(prevaddr, le.addr, TXADDRLEN);
-      if(fwrite(&le, 1, sizeof(LENTRY), lfp) != sizeof(LENTRY))
-         goto error2;
    }
-   if(hdrlen) {
-      error("extract(): bad neo-genesis block length");
-      goto error2;
+   /* Copy the ledger to lfile, creating a new ledger.dat file. */
+   if(br_copy(&br, 4, br.hdrlen - 4, lfile) != VEOK) {
+      error("extract(): Cannot write %s", lfile);
+      goto ioerror;
    }
-   fclose(fp);
-   fclose(lfp);
+   br_close(&br);
    return VEOK;
 ioerror:
-      fclose(fp);
+      br_close(&br);
       unlink(lfile);  /* remove bad ledger */
       return error("extract() failed!");
-error2:
-   fclose(lfp);
-   goto ioerror;
 }  /* end extract() */
 
 
@@ -285,67 +276,123 @@ void add_weight(byte *weight, int difficulty)
 }  /* end add_weight() */
 
 
-/* Validate a tfile
- * Returns: a pointer to static weight.
- *          *result is set to 0 on success with the block number
- *          of last good tfile record is left in highblock,
- *          otherwise *result is set to non-zero error code.
- *
- * Error codes 1-8 are validation errors; codes >= 100 are I/O, 
- * codes >= 200 are (errno + 200).
- */
-byte *tfval(char *fname, byte *highblock, int weight_only, int *result)
+/* Start st at the Genesis Block.  Returns VEOK or VERROR. */
+int tfstart(TFSTATE *st)
 {
-   FILE *fp;
    BTRAILER bt;
-   word32 difficulty = 0;
-   word32 time1 = 0;
-   word32 stemp;
-   byte prevhash[HASHLEN];
-   static byte weight[HASHLEN];   /* return value */
-   long filelen;
-   int ecode, gblock;
    char genfile[100];
 
-   *result = 100;                 /* I/O high error code */
-   memset(highblock, 0, 8);       /* start from genesis block */
-   memset(weight, 0, HASHLEN);
-
-   if(Trace) plog("Entering tfval()");
-   show("tfval");
-
+   memset(st, 0, sizeof(TFSTATE));
    sprintf(genfile, "%s/b0000000000000000.bc", Bcdir);
    /* get trailer from our Genesis Block */
-   if(readtrailer(&bt, genfile) != VEOK) return weight;  /* error 100 */
-   memcpy(prevhash, bt.bhash, HASHLEN);
+   if(readtrailer(&bt, genfile) != VEOK) return VERROR;
+   memcpy(st->prevhash, bt.bhash, HASHLEN);
+   return VEOK;
+}
 
-   fp = fopen(fname, "rb");
-   if(!fp) {
-      error("tfval(): Cannot open %s", fname);
-      *result = 101;
-      return weight;
+
+#define TFCHUNK  1024   /* trailers read and checked at once */
+
+/* Trailers for one tfval_thread() */
+typedef struct {
+   BTRAILER *bt;
+   byte *ok;       /* ok[j] set if bt[j] passes trigg_check() */
+   int j, n, step; /* does j, j + step, ... below n */
+} TFJOB;
+
+
+void *tfval_thread(void *arg)
+{
+   TFJOB *jp;
+   TRIGG t;
+   BTRAILER *bt;
+   int j;
+
+   jp = arg;
+   for(j = jp->j; j < jp->n; j += jp->step) {
+      bt = &jp->bt[j];
+      /* neo-genesis blocks are not solved */
+      jp->ok[j] = bt->bnum[0] == 0
+                  || trigg_check2(&t, bt->mroot, bt->difficulty[0],
+                                  bt->bnum) != NULL;
    }
+   return NULL;
+}
 
-   fseek(fp, 0, SEEK_END);
-   filelen = ftell(fp);
-   if((filelen % sizeof(BTRAILER)) != 0) {
-      fclose(fp);
-      *result = 102;
-      return weight;
+
+/* Run trigg_check() on n trailers bt[] with up to TFTHREADS threads,
+ * one per CPU, and set ok[] for each.  Each thread has its own TRIGG.
+ */
+void tfval_par(BTRAILER *bt, byte *ok, int n)
+{
+   pthread_t tid[TFTHREADS];
+   byte started[TFTHREADS];
+   TFJOB job[TFTHREADS];
+   long ncpu;
+   int k, nt;
+
+   ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+   nt = ncpu < 1 ? 1 : ncpu > TFTHREADS ? TFTHREADS : ncpu;
+   if(nt > n) nt = n;
+   for(k = 0; k < nt; k++) {
+      job[k].bt = bt;
+      job[k].ok = ok;
+      job[k].j = k;
+      job[k].n = n;
+      job[k].step = nt;
+      started[k] = k > 0 && pthread_create(&tid[k], NULL, tfval_thread,
+                                           &job[k]) == 0;
    }
-   fseek(fp, 0, SEEK_SET);
+   /* this thread does its own share, and any that did not start */
+   for(k = 0; k < nt; k++)
+      if(!started[k]) tfval_thread(&job[k]);
+   for(k = 1; k < nt; k++)
+      if(started[k]) pthread_join(tid[k], NULL);
+}  /* end tfval_par() */
+
+
+/* Validate the trailers in fp from st->bnum on, up to trailer stop
+ * or end of file if stop is NULL, and advance st past each good one.
+ * With weight_only, trust them and only add up the weight.
+ * Trailers are read TFCHUNK at a time and tfval_par() runs
+ * trigg_check() on them all, then the checks that depend on the
+ * trailer before run in order.
+ * Returns 0 at stop or end of file, else the tfval() error code.
+ */
+int tfval_run(FILE *fp, TFSTATE *st, byte *stop, int weight_only)
+{
+   BTRAILER *buff, *bt;
+   byte *ok, *highblock, left[8];
+   word32 stemp;
+   int ecode, j, n, count;
 
-   /* Validate every block trailer in tfile and compute weight. */
-   for(gblock = 1; ; gblock = 0) {
+   buff = malloc(TFCHUNK * (sizeof(BTRAILER) + 1));
+   if(buff == NULL) return 100;
+   ok = (byte *) &buff[TFCHUNK];
+   highblock = st->bnum;  /* bnum of the next trailer */
+   for(j = n = 0; ; j++) {
       ecode = 0;
-      if(fread(&bt, 1, sizeof(BTRAILER), fp)
-            != sizeof(BTRAILER)) break;  ecode++;
+      if(stop && cmp64(highblock, stop) >= 0) break;
+      if(j >= n) {
+         count = TFCHUNK;
+         if(stop) {
+            sub64(stop, highblock, left);
+            if(get32(left + 4) == 0 && get32(left) < count)
+               count = get32(left);
+         }
+         n = fread(buff, sizeof(BTRAILER), count, fp);
+         j = 0;
+         if(n < 1) break;
+         if(!weight_only) tfval_par(buff, ok, n);
+      }
+      bt = &buff[j];
+      ecode++;
 
       /* The Genesis Block is very special. 1 */
-      if(gblock) {
-         if(!iszero(&bt, (sizeof(BTRAILER) - HASHLEN))) break;  ecode++;
-         if(memcmp(prevhash, bt.bhash, HASHLEN) != 0) break;  /* 2 */
-         difficulty = 1;  /* difficulty of block one. */
+      if(iszero(highblock, 8)) {
+         if(!iszero(bt, (sizeof(BTRAILER) - HASHLEN))) break;  ecode++;
+         if(memcmp(st->prevhash, bt->bhash, HASHLEN) != 0) break;  /* 2 */
+         st->difficulty = 1;  /* difficulty of block one. */
          goto next;
       }
       if(weight_only) goto skipval;
@@ -353,55 +400,208 @@ byte *tfval(char *fname, byte *highblock, int weight_only, int *result)
       ecode = 3;
       /* validate block trailer -- Mfee: 3 */
       if(highblock[0]) {
-         if(memcmp(Mfee, bt.mfee, 8) != 0) break;
-      } else if(!iszero(bt.mfee, 8)) break;  /* for NG block */
+         if(memcmp(Mfee, bt->mfee, 8) != 0) break;
+      } else if(!iszero(bt->mfee, 8)) break;  /* for NG block */
 
       ecode++;  /* difficulty ecode = 4 */
-      if(get32(bt.difficulty) != difficulty) break;  ecode++;
+      if(get32(bt->difficulty) != st->difficulty) break;  ecode++;
 
       /* check for early block time 5 */
-      stemp = get32(bt.stime);
+      stemp = get32(bt->stime);
       if(highblock[0]) {
-         if(stemp <= time1)  /* unsigned time here */
+         if(stemp <= st->time1)  /* unsigned time here */
             break;
       }
-      else if(stemp != time1) break;  /* for NG block */
+      else if(stemp != st->time1) break;  /* for NG block */
       ecode++;
       /* bad block number 6 */
-      if(cmp64(highblock, bt.bnum) != 0) break;     ecode++;
+      if(cmp64(highblock, bt->bnum) != 0) break;     ecode++;
       /* bad previous hash 7 */
-      if(memcmp(prevhash, bt.phash, HASHLEN) != 0) break;  ecode++;
-      /* check enforced delay 8 */
+      if(memcmp(st->prevhash, bt->phash, HASHLEN) != 0) break;  ecode++;
+      /* check enforced delay 8: tfval_par() did trigg_check() */
       if(highblock[0]) {
-         if(trigg_check(bt.mroot, bt.difficulty[0], bt.bnum) == NULL)
-            break;
+         if(!ok[j]) break;
          ecode++;
          /* empty block 9 */
-         if(get32(bt.tcount) == 0) break;
+         if(get32(bt->tcount) == 0) break;
       }
       ecode = 10;
 
 skipval:
       /* update for next loop 10 */
-      time1 = get32(bt.stime);
+      st->time1 = get32(bt->stime);
       if(Trace) plog("block: 0x%s difficulty: %d  seconds: %d",
-           bnum2hex(bt.bnum), difficulty, time1 - get32(bt.time0));
+           bnum2hex(bt->bnum), st->difficulty,
+           st->time1 - get32(bt->time0));
       /*
        * Let the neo-genesis (not the 0xff) block change the 
        * difficulty for the next 0x01 block.
        */
       if(highblock[0] != 0xff) {
-         add_weight(weight, difficulty);
-         difficulty = set_difficulty(difficulty, time1 - get32(bt.time0));
-         if(Trace) plog("new difficulty: %d", difficulty);  /* debug */
+         add_weight(st->weight, st->difficulty);
+         st->difficulty = set_difficulty(st->difficulty,
+                                         st->time1 - get32(bt->time0));
+         if(Trace) plog("new difficulty: %d", st->difficulty);  /* debug */
       }
 next:
       /* set previous hash for next iteration */
-      memcpy(prevhash, bt.bhash, HASHLEN);
+      memcpy(st->prevhash, bt->bhash, HASHLEN);
       add64(highblock, One, highblock);  /* bnum in next trailer */
    }  /* end for */
-   sub64(highblock, One, highblock);     /* fix high block number */
+   free(buff);
+   return ecode;
+}  /* end tfval_run() */
+
+
+/* Open tfile fname for tfval_run().
+ * Returns NULL and sets *result to a tfval() error code on failure.
+ */
+FILE *tfopen(char *fname, int *result)
+{
+   FILE *fp;
+   long filelen;
+
+   fp = fopen(fname, "rb");
+   if(!fp) {
+      error("tfval(): Cannot open %s", fname);
+      *result = 101;
+      return NULL;
+   }
+   fseek(fp, 0, SEEK_END);
+   filelen = ftell(fp);
+   if((filelen % sizeof(BTRAILER)) != 0) {
+      fclose(fp);
+      *result = 102;
+      return NULL;
+   }
+   fseek(fp, 0, SEEK_SET);
+   return fp;
+}
+
+
+/* Add the next len bytes of fp to ctx.
+ * Returns VEOK, or VERROR if fp is shorter.
+ */
+int tfhash(FILE *fp, SHA256_CTX *ctx, long len)
+{
+   byte buff[4096];
+   long n;
+
+   for( ; len > 0; len -= n) {
+      n = len > sizeof(buff) ? sizeof(buff) : len;
+      if(fread(buff, 1, n, fp) != n) return VERROR;
+      sha256_update(ctx, buff, n);
+   }
+   return VEOK;
+}
+
+
+/* Start st for tfile fp at the checkpoint in tfcheck.dat if fp
+ * begins with the trailers it was made from, and stop, if not NULL,
+ * is not below it.  Else start st at the Genesis Block.  On return
+ * fp is at trailer st->bnum and ctx has the trailers before it.
+ * Returns VEOK or VERROR.
+ */
+int tfresume(FILE *fp, TFSTATE *st, byte *stop, SHA256_CTX *ctx)
+{
+   FILE *ckfp;
+   TFCHECK ck;
+   SHA256_CTX ctx2;
+   byte hash[HASHLEN];
+   int ok;
+
+   sha256_init(ctx);
+   if(tfstart(st) != VEOK) return VERROR;
+   ckfp = fopen("tfcheck.dat", "rb");
+   if(ckfp == NULL) return VEOK;
+   ok = fread(&ck, 1, sizeof(TFCHECK), ckfp) == sizeof(TFCHECK)
+        && crc16(&ck, sizeof(TFSTATE) + HASHLEN) == get16(ck.crc16)
+        && get32(ck.st.bnum + 4) == 0
+        && (stop == NULL || cmp64(ck.st.bnum, stop) <= 0);
+   fclose(ckfp);
+   if(ok && tfhash(fp, ctx, (long) get32(ck.st.bnum) * sizeof(BTRAILER))
+      == VEOK) {
+      memcpy(&ctx2, ctx, sizeof(SHA256_CTX));
+      sha256_final(&ctx2, hash);
+      if(memcmp(hash, ck.tfhash, HASHLEN) == 0) {
+         memcpy(st, &ck.st, sizeof(TFSTATE));
+         if(Trace) plog("tfval(): resume at 0x%s", bnum2hex(st->bnum));
+         return VEOK;
+      }
+   }
+   sha256_init(ctx);
+   fseek(fp, 0, SEEK_SET);
+   return VEOK;
+}  /* end tfresume() */
+
+
+/* Write tfcheck.dat for st with ctx, the hash of all before it. */
+int tfcheck(TFSTATE *st, SHA256_CTX *ctx)
+{
+   FILE *fp;
+   TFCHECK ck;
+
+   memcpy(&ck.st, st, sizeof(TFSTATE));
+   sha256_final(ctx, ck.tfhash);
+   put16(ck.crc16, crc16(&ck, sizeof(TFSTATE) + HASHLEN));
+   fp = fopen("tfcheck.tmp", "wb");
+   if(fp == NULL) return VERROR;
+   if(fwrite(&ck, 1, sizeof(TFCHECK), fp) != sizeof(TFCHECK)) {
+      fclose(fp);
+      unlink("tfcheck.tmp");
+      return VERROR;
+   }
    fclose(fp);
+   return rename("tfcheck.tmp", "tfcheck.dat");
+}
+
+
+/* Validate a tfile
+ * Returns: a pointer to static weight.
+ *          *result is set to 0 on success with the block number
+ *          of last good tfile record is left in highblock,
+ *          otherwise *result is set to non-zero error code.
+ *
+ * Only the trailers after the checkpoint in tfcheck.dat are checked
+ * if fname begins with the ones it was made from.  A good tfile
+ * leaves a new checkpoint at its end, unless weight_only.
+ *
+ * Error codes 1-8 are validation errors; codes >= 100 are I/O, 
+ * codes >= 200 are (errno + 200).
+ */
+byte *tfval(char *fname, byte *highblock, int weight_only, int *result)
+{
+   FILE *fp;
+   TFSTATE st;
+   SHA256_CTX ctx;
+   static byte weight[HASHLEN];   /* return value */
+   long start;
+   int ecode;
+
+   *result = 100;                 /* I/O high error code */
+   memset(highblock, 0, 8);       /* start from genesis block */
+   memset(weight, 0, HASHLEN);
+
+   if(Trace) plog("Entering tfval()");
+   show("tfval");
+
+   fp = tfopen(fname, result);
+   if(!fp) return weight;
+   if(tfresume(fp, &st, NULL, &ctx) != VEOK) {
+      fclose(fp);
+      *result = 100;
+      return weight;
+   }
+   start = ftell(fp);
+
+   /* Validate every block trailer after it and compute weight. */
+   ecode = tfval_run(fp, &st, NULL, weight_only);
+   if(ecode == 0 && !weight_only && fseek(fp, start, SEEK_SET) == 0
+      && tfhash(fp, &ctx, (long) get32(st.bnum) * sizeof(BTRAILER)
+                - start) == VEOK) tfcheck(&st, &ctx);
+   fclose(fp);
+   memcpy(weight, st.weight, HASHLEN);
+   sub64(st.bnum, One, highblock);     /* fix high block number */
    if(Trace) plog("tfval(): ecode = %d  bnum = 0x%s  weight = 0x...%x",
                   ecode, bnum2hex(highblock), weight[0]);
    *result = ecode;
@@ -409,6 +609,72 @@ next:
 }  /* end tfval() */
 
 
+/* Set st to where our own tfile.dat is at trailer bnum.
+ * Returns VEOK, or VERROR if it is shorter.
+ */
+int tfstate(byte *bnum, TFSTATE *st)
+{
+   FILE *fp;
+   SHA256_CTX ctx;
+   int result;
+
+   fp = tfopen("tfile.dat", &result);
+   if(!fp) return VERROR;
+   result = tfresume(fp, st, bnum, &ctx);
+   if(result == VEOK) result = tfval_run(fp, st, bnum, 1);  /* trusted */
+   fclose(fp);
+   if(result != 0 || cmp64(st->bnum, bnum) != 0) return VERROR;
+   return VEOK;
+}
+
+
+/* Get peer ip's trailers from block bnum on with OP_GET_TRAILERS,
+ * and validate only them, on top of our own tfile.dat through block
+ * bnum - 1.  If they are good, put them in tfile.dat after ours.
+ * Returns a pointer to static weight and sets highblock like tfval(),
+ * or NULL on failure, and get_eon() fetches all of tfile.dat.
+ */
+byte *tfval_tail(word32 ip, byte *bnum, byte *highblock)
+{
+   FILE *fp, *fpout;
+   TFSTATE st;
+   static byte weight[HASHLEN];   /* return value */
+   char buff[4096];
+   int n, result;
+
+   if(tfstate(bnum, &st) != VEOK) return NULL;
+   if(get_block2(ip, bnum, "tftail.dat", OP_GET_TRAILERS) != VEOK)
+      return NULL;
+   fp = tfopen("tftail.dat", &result);
+   if(!fp) goto bad;
+   result = tfval_run(fp, &st, NULL, 0);
+   if(Trace) plog("tfval_tail(): ecode = %d  next bnum = 0x%s",
+                  result, bnum2hex(st.bnum));
+   if(result != 0) goto bad;
+   /* keep ours through bnum - 1 and append hers */
+   if(truncate("tfile.dat", (off_t) get32(bnum) * sizeof(BTRAILER)) != 0)
+      goto bad;
+   fpout = fopen("tfile.dat", "ab");
+   if(!fpout) goto bad;
+   fseek(fp, 0, SEEK_SET);
+   while((n = fread(buff, 1, sizeof(buff), fp)) > 0)
+      if(fwrite(buff, 1, n, fpout) != n) break;
+   if(fclose(fpout) != 0 || n > 0) {
+      unlink("tfile.dat");  /* get_eon() fetches it all */
+      goto bad;
+   }
+   fclose(fp);
+   unlink("tftail.dat");
+   memcpy(weight, st.weight, HASHLEN);
+   sub64(st.bnum, One, highblock);
+   return weight;
+bad:
+   if(fp) fclose(fp);
+   unlink("tftail.dat");
+   return NULL;
+}  /* end tfval_tail() */
+
+
 /* Delete all blocks above bc/matchblock.
  * Returns number of blocks deleted.
  */
@@ -483,7 +749,8 @@ int get_eon(NODE *np, word32 peerip)
    word32 gang[MAXQUORUM];
    byte bnum[8], ngnum[8], highbnum[8];
    byte highhash[HASHLEN], *tfweight;
-   byte highweight[HASHLEN];
+   byte highweight[HASHLEN], tfnum[8];
+   struct stat st;
    int k, j, result, result2;
    char fname[80];
    time_t timeout;
@@ -526,24 +793,42 @@ top:
    }
    if(!Running) resign("quorum debate");  /* System/360 Emergency Pull! */
 
-   if(Trace) plog("   fetching tfile.dat from %s", ntoa((byte *) &gang[0]));
    show("tfile");
 
-   unlink("tfile.dat");
-
-   /* get the peer's tfile and validate it */
-   for(k = 0; k < Quorum && Running; k++) {
-      peerip = gang[k];
-      if(get_block2(peerip, NULL, "tfile.dat", OP_GET_TFILE) != VEOK)
-         continue;  /* try to get block again from next peer in gang[] */
-      tfweight = tfval("tfile.dat", bnum, 0, &result);
-      if(result) goto try_again;  /* I/O error */
-      if(cmp64(highbnum, bnum) > 0) goto try_again;
-      if(memcmp(tfweight, highweight, HASHLEN) < 0) goto try_again;
-      break;  /* success */
+   /* Ask for the peer's trailers after most of ours, and validate
+    * just those.  Our last TFBACK are fetched again in case she
+    * forked from us.  If any of it fails, get her whole tfile.
+    */
+   tfweight = NULL;
+   if(stat("tfile.dat", &st) == 0
+      && st.st_size / sizeof(BTRAILER) > TFBACK + 1) {
+      memset(tfnum, 0, 8);
+      put32(tfnum, st.st_size / sizeof(BTRAILER) - TFBACK);
+      if(Trace) plog("   fetching trailers from 0x%s from %s",
+                     bnum2hex(tfnum), ntoa((byte *) &gang[0]));
+      tfweight = tfval_tail(gang[0], tfnum, bnum);
+      if(tfweight && (cmp64(highbnum, bnum) > 0
+         || memcmp(tfweight, highweight, HASHLEN) < 0)) tfweight = NULL;
+   }
+   if(tfweight == NULL) {
+      if(Trace) plog("   fetching tfile.dat from %s",
+                     ntoa((byte *) &gang[0]));
+      unlink("tfile.dat");
+
+      /* get the peer's tfile and validate it */
+      for(k = 0; k < Quorum && Running; k++) {
+         peerip = gang[k];
+         if(get_block2(peerip, NULL, "tfile.dat", OP_GET_TFILE) != VEOK)
+            continue;  /* try to get block again from next peer in gang[] */
+         tfweight = tfval("tfile.dat", bnum, 0, &result);
+         if(result) goto try_again;  /* I/O error */
+         if(cmp64(highbnum, bnum) > 0) goto try_again;
+         if(memcmp(tfweight, highweight, HASHLEN) < 0) goto try_again;
+         break;  /* success */
+      }
+      if(!Running) resign("quorum tfile");
+      if(k >= Quorum) goto try_again;
    }
-   if(!Running) resign("quorum tfile");
-   if(k >= Quorum) goto try_again;
 
    if(Trace) plog("get_eon(): tfile.dat is valid.");
 
@@ -585,6 +870,25 @@ top:
    reset_difficulty(NULL, Bcdir);  /* based on [neo-]genesis block */
 
    add64(bnum, One, bnum);
+   /* Download blocks up to highbnum from all of gang[] at once,
+    * while we validate and update them here in order.
+    */
+   if(cmp64(bnum, highbnum) <= 0) {
+      if(sync_start(gang, Quorum, bnum, highbnum) != VEOK) goto try_again;
+      while(Running && cmp64(bnum, highbnum) <= 0) {
+         if(Trace) plog("update block 0x%s", bnum2hex(bnum));
+         if(sync_next(bnum, fname, &Peerip) != VEOK) break;
+         result = update(fname, 0);  /* pinklists Peerip if bad */
+         unlink(fname);
+         if(result != VEOK) break;
+         add64(bnum, One, bnum);
+         if(bnum[0] == 0)
+            add64(bnum, One, bnum);  /* do not fetch NG blocks */
+      }
+      sync_stop();
+      if(cmp64(bnum, highbnum) <= 0 && Running) goto try_again;
+   }
+   /* then any blocks solved since the quorum */
    for( ; Running; ) {
       if(Trace) plog("fetch block 0x%s", bnum2hex(bnum));
       if(get_block2(peerip, bnum, "rblock.dat", OP_GETBLOCK) != VEOK) {
@@ -653,6 +957,10 @@ int init(void)
    plog("Entering init()");
    show("init");
 
+   /* finish or undo an update cut short by a crash */
+   if(recover_update() != VEOK)
+      resync("init(): cannot recover update -- gomochi!");
+
    /* open ledger read-only */
    if(!exists("ledger.dat") || le_open("ledger.dat", "rb") != VEOK) {
       /* extract the ledger from our Genesis Block */
@@ -674,7 +982,7 @@ int init(void)
    /* Read and validate our own tfile.dat to compute Weight */
    wp = tfval("tfile.dat", highblock, 0, &result);
    if(result || cmp64(Cblocknum, highblock) != 0)
-      fatal("init(): bad tfile.dat -- gomochi!");
+      resync("init(): bad tfile.dat -- gomochi!");
    memcpy(Weight, wp, HASHLEN);
 
    /* read into Coreplist[] and shuffle  */
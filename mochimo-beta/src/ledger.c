@@ -84,3 +84,71 @@ int le_find(byte *addr, LENTRY *le, long *position)
    if(position) *position = low;
    return 0;  /* not found */
 }  /* end le_find() */
+
+
+int le_keycmp(const void *a, const void *b)
+{
+   return memcmp(*(byte **) a, *(byte **) b, BALKEYLEN);
+}
+
+
+/* Look up the balances of the n addresses whose first BALKEYLEN
+ * bytes are at keys[].  For each, put in found[n] BAL_NONE if no
+ * ledger address has that prefix, BAL_ONE if one does, with its
+ * balance in bal[n][TXAMOUNT] and the sha256() of its full address
+ * in hash[n][HASHLEN], or BAL_MANY if more than one does.
+ * bal[] and hash[] are zero but for BAL_ONE.  Anyone can fund an
+ * address with a chosen prefix, so the caller checks a BAL_ONE hash
+ * against the address it meant: if they differ, that address is not
+ * in the ledger.
+ * The keys are sorted, so one pass up the ledger finds them all:
+ * each search starts where the last one ended.
+ * Returns VEOK, or VERROR on I/O errors.
+ */
+int le_balances(byte *keys, int n, byte *bal, byte *hash, byte *found)
+{
+   byte *kp[BALSLEN], addr[BALKEYLEN];
+   LENTRY le;
+   long mid, hi, low;
+   int j, k;
+
+   if(Lefp == NULL) return (Lerror = error("le_balances(): no ledger"));
+   if(n > BALSLEN) n = BALSLEN;
+   for(j = 0; j < n; j++) kp[j] = keys + j * BALKEYLEN;
+   qsort(kp, n, sizeof(byte *), le_keycmp);
+   memset(bal, 0, n * TXAMOUNT);
+   memset(hash, 0, n * HASHLEN);
+   memset(found, BAL_NONE, n);
+
+   low = 0;
+   for(j = 0; j < n; j++) {
+      /* find the first entry not below kp[j], from low on */
+      hi = Nledger;
+      while(low < hi) {
+         mid = (low + hi) / 2;
+         if(fseek(Lefp, mid * sizeof(LENTRY), SEEK_SET) != 0
+            || fread(addr, 1, BALKEYLEN, Lefp) != BALKEYLEN) goto bad;
+         if(memcmp(addr, kp[j], BALKEYLEN) < 0) low = mid + 1;
+         else hi = mid;
+      }
+      if(low >= (long) Nledger) break;  /* the rest are past the end */
+      if(fseek(Lefp, low * sizeof(LENTRY), SEEK_SET) != 0
+         || fread(&le, 1, sizeof(LENTRY), Lefp) != sizeof(LENTRY)) goto bad;
+      if(memcmp(le.addr, kp[j], BALKEYLEN) != 0) continue;
+      k = (kp[j] - keys) / BALKEYLEN;
+      /* does the next entry share the prefix? */
+      if(low + 1 < (long) Nledger) {
+         if(fread(addr, 1, BALKEYLEN, Lefp) != BALKEYLEN) goto bad;
+         if(memcmp(addr, kp[j], BALKEYLEN) == 0) {
+            found[k] = BAL_MANY;
+            continue;
+         }
+      }
+      found[k] = BAL_ONE;
+      memcpy(bal + k * TXAMOUNT, le.balance, TXAMOUNT);
+      sha256(le.addr, TXADDRLEN, hash + k * HASHLEN);
+   }
+   return VEOK;
+bad:
+   return (Lerror = error("le_balances(): I/O error"));
+}  /* end le_balances() */
@@ -0,0 +1,172 @@
+/* local.c  Local query socket for tools on this host
+ *
+ * Copyright (c) 2018 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.TXT   **** NO WARRANTY ****
+ *
+ * The Mochimo Project System Software
+ *
+ * Date: 19 October 2026
+ *
+ * server() listens on the Unix-domain socket LOCALSOCK in its
+ * directory, mode 0660, and answers small reads of its own state
+ * there with no OP_HELLO, pink list, or Nodes[] slot.  A request is
+ *
+ *    op[2]  len[2]  data[len]          (len <= LQMAXLEN)
+ *
+ * and its answer is
+ *
+ *    status[2]  len[2]  data[len]
+ *
+ * with status LQ_OK, LQ_NOTFOUND, LQ_BAD, or LQ_ERROR.  Numbers are
+ * little-endian, as in a TX.  Requests:
+ *
+ *    LQ_BALANCE   addresses: TXADDRLEN bytes each, LQMAXBAL at most.
+ *                 Answer: TXAMOUNT balance each, in the same order,
+ *                 then a byte each: 1 if the address is in the ledger,
+ *                 else 0 and its balance is zero.
+ *    LQ_TAG       tag: ADDR_TAG_LEN bytes.  Answer: the TXADDRLEN
+ *                 address with the tag and its TXAMOUNT balance.
+ *    LQ_TIP       no data.  Answer: Cblocknum[8], Cblockhash[32],
+ *                 Prevhash[32], Weight[32], Difficulty[4], Time0[4].
+ *    LQ_TRAILER   bnum[8].  Answer: the BTRAILER of block bnum from
+ *                 tfile.dat.
+ *    LQ_MEMPOOL   no data.  Answer: Txcount[4], TX's in txq1.dat.
+ *
+ * A connection may send any number of requests, STREAM_TIMEOUT
+ * seconds apart at most.  See evloop.c.
+*/
+
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#define LQHDR     4   /* op or status[2] and len[2] */
+#define LQMAXBAL  (65535 / TXADDRLEN)     /* addresses per LQ_BALANCE */
+#define LQMAXLEN  (LQMAXBAL * TXADDRLEN)  /* longest request data */
+
+
+/* Open the listening socket at path, replacing any old one.
+ * Returns INVALID_SOCKET on error.
+ */
+SOCKET local_open(char *path)
+{
+   struct sockaddr_un addr;
+   SOCKET sd;
+
+   if(strlen(path) >= sizeof(addr.sun_path)) return INVALID_SOCKET;
+   sd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if(sd == INVALID_SOCKET) return INVALID_SOCKET;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, path);
+   unlink(path);  /* left from a crash */
+   if(bind(sd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+      || chmod(path, 0660) != 0 || listen(sd, LQLEN) != 0
+      || nonblock(sd) == -1) {
+      closesocket(sd);
+      unlink(path);
+      return INVALID_SOCKET;
+   }
+   fcntl(sd, F_SETFD, FD_CLOEXEC);  /* keep it out of bcon and friends */
+   return sd;
+}  /* end local_open() */
+
+
+/* Read block bnum's trailer from tfile.dat into bt.
+ * Returns VEOK, VEBAD if there is no such block, or VERROR.
+ */
+int local_trailer(byte *bnum, BTRAILER *bt)
+{
+   FILE *fp;
+   word32 n;
+   int status;
+
+   if(get32(bnum + 4) != 0) return VEBAD;
+   n = get32(bnum);
+   fp = fopen("tfile.dat", "rb");
+   if(fp == NULL) return VERROR;
+   status = VEBAD;
+   if(fseek(fp, (long) n * BTSIZE, SEEK_SET) == 0
+      && fread(bt, 1, BTSIZE, fp) == BTSIZE
+      && memcmp(bt->bnum, bnum, 8) == 0) status = VEOK;
+   fclose(fp);
+   return status;
+}
+
+
+/* Answer the request in[LQHDR + LQMAXLEN] on sd.
+ * Returns VEOK, or VERROR to drop the connection.
+ */
+int local_query(SOCKET sd, byte *in)
+{
+   static byte out[LQHDR + TRANLEN];
+   byte *bp;
+   LENTRY le;
+   long position;
+   int op, len, n, j, lockfd, status;
+
+   op = get16(in);
+   len = get16(in + 2);
+   in += LQHDR;
+   bp = out + LQHDR;
+   status = LQ_BAD;
+   n = 0;
+   switch(op) {
+      case LQ_BALANCE:
+         if(len % TXADDRLEN) break;
+         if(Lefp == NULL) { status = LQ_ERROR;  break; }
+         lockfd = lock("txq1.lck", 20);
+         if(lockfd == -1) { status = LQ_ERROR;  break; }
+         n = len / TXADDRLEN;
+         memset(bp, 0, n * (TXAMOUNT + 1));
+         /* look up each as send_balance() does */
+         for(j = 0; j < n; j++, in += TXADDRLEN) {
+            if(le_find(in, &le, NULL) != TRUE) continue;
+            memcpy(bp + j * TXAMOUNT, le.balance, TXAMOUNT);
+            bp[n * TXAMOUNT + j] = 1;
+         }
+         unlock(lockfd);
+         n *= TXAMOUNT + 1;
+         status = LQ_OK;
+         break;
+      case LQ_TAG:
+         if(len != ADDR_TAG_LEN) break;
+         memset(bp, 0, TXADDRLEN);
+         memcpy(ADDR_TAG_PTR(bp), in, ADDR_TAG_LEN);
+         if(tag_find(bp, &le, &position) != VEOK) status = LQ_ERROR;
+         else if(position == -1) status = LQ_NOTFOUND;
+         else {
+            memcpy(bp, le.addr, TXADDRLEN);
+            memcpy(bp + TXADDRLEN, le.balance, TXAMOUNT);
+            n = TXADDRLEN + TXAMOUNT;
+            status = LQ_OK;
+         }
+         break;
+      case LQ_TIP:
+         if(len != 0) break;
+         memcpy(bp, Cblocknum, 8);
+         memcpy(bp + 8, Cblockhash, HASHLEN);
+         memcpy(bp + 40, Prevhash, HASHLEN);
+         memcpy(bp + 72, Weight, HASHLEN);
+         put32(bp + 104, Difficulty);
+         put32(bp + 108, Time0);
+         n = 112;
+         status = LQ_OK;
+         break;
+      case LQ_TRAILER:
+         if(len != 8) break;
+         status = local_trailer(in, (BTRAILER *) bp);
+         if(status == VEOK) { n = BTSIZE;  status = LQ_OK; }
+         else status = status == VEBAD ? LQ_NOTFOUND : LQ_ERROR;
+         break;
+      case LQ_MEMPOOL:
+         if(len != 0) break;
+         put32(bp, Txcount);
+         n = 4;
+         status = LQ_OK;
+         break;
+   }  /* end switch */
+   if(Trace > 1) plog("local query %d: status %d", op, status);
+   put16(out, status);
+   put16(out + 2, n);
+   return sendall(sd, out, LQHDR + n, 1) == VEOK ? VEOK : VERROR;
+}  /* end local_query() */
@@ -7,8 +7,81 @@
  *
  * Date: 13 January 2018
  *
+ * Revised 19 October 2026: miner() solves with Nminers threads, each
+ * with its own TRIGG and rand2r() seed, kept in mseed.dat.  The first
+ * thread to solve stops the others.
 */
 
+#include <pthread.h>
+
+/* One solving thread */
+typedef struct {
+   TRIGG t;
+   byte link[HASHLEN * 2];  /* mroot and nonce, as in BTRAILER */
+   BTRAILER *bt;
+   unsigned long count;     /* haiku tried */
+   pthread_t tid;
+   byte started;
+} MTHREAD;
+
+MTHREAD Mthread[MAXMINERS];
+volatile byte Msolved;      /* set by the first thread to solve */
+pthread_mutex_t Msolvemutex = PTHREAD_MUTEX_INITIALIZER;
+byte Mlink[HASHLEN * 2];    /* the solved mroot and nonce */
+char Mhaiku[256 + 1];
+
+
+void *mine_thread(void *arg)
+{
+   MTHREAD *mp;
+   char *haiku;
+
+   mp = arg;
+   /* Traverse all TRIGG links to build the
+    * solution chain with trigg_generate8(), TLANES at a time...
+    */
+   for( ; Running && !Msolved; mp->count += TLANES) {
+      haiku = trigg_generate8(&mp->t, mp->link, mp->bt->difficulty[0]);
+      if(haiku == NULL) continue;
+      pthread_mutex_lock(&Msolvemutex);
+      if(!Msolved) {
+         memcpy(Mlink, mp->link, sizeof(Mlink));
+         strncpy(Mhaiku, haiku, 256);
+         Msolved = 1;
+      }
+      pthread_mutex_unlock(&Msolvemutex);
+   }
+   return NULL;
+}  /* end mine_thread() */
+
+
+/* Solve bt with n threads.  Returns 1 if solved, else 0. */
+int mine(BTRAILER *bt, int n)
+{
+   int k;
+
+   Msolved = 0;
+   for(k = 0; k < n; k++) {
+      memcpy(Mthread[k].link, bt->mroot, sizeof(Mthread[k].link));
+      Mthread[k].bt = bt;
+      Mthread[k].count = 0;
+      /* Create the solution state-space beginning with
+       * the first plausible link on the TRIGG chain.
+       * (The first call also builds trigg.c's tables.)
+       */
+      trigg_solve2(&Mthread[k].t, Mthread[k].link, bt->difficulty[0],
+                   bt->bnum);
+      Mthread[k].started = k > 0 && pthread_create(&Mthread[k].tid, NULL,
+                                      mine_thread, &Mthread[k]) == 0;
+   }
+   mine_thread(&Mthread[0]);  /* this one is thread 0 */
+   for(k = 1; k < n; k++)
+      if(Mthread[k].started) pthread_join(Mthread[k].tid, NULL);
+   if(!Msolved) return 0;
+   memcpy(bt->mroot, Mlink, sizeof(Mlink));  /* mroot and nonce */
+   return 1;
+}  /* end mine() */
+
 
 /* miner blockin blockout -- child process */
 int miner(char *blockin, char *blockout)
@@ -17,15 +90,27 @@ int miner(char *blockin, char *blockout)
    FILE *fp;
    byte *ptr;
    SHA256_CTX bctx;  /* to resume entire block hash after bcon.c */
-   char *haiku;
    word32 hps;
    time_t htime;
    unsigned long hcount;
-   word32 temp[3];
+   word32 seed[MAXMINERS][3];
+   int j, k, n;
 
-   /* Keep a separate rand2() sequence for miner child */
-   if(read_data(&temp, 12, "mseed.dat") == 12)
-      srand2(temp[0], temp[1], temp[2]);
+   n = Nminers;
+   if(n < 1) n = sysconf(_SC_NPROCESSORS_ONLN);
+   if(n < 1) n = 1;
+   if(n > MAXMINERS) n = MAXMINERS;
+   /* Keep a separate rand2r() sequence for each miner thread */
+   j = read_data(seed, sizeof(seed), "mseed.dat") / sizeof(seed[0]);
+   for(k = 0; k < n; k++) {
+      if(k < j) memcpy(Mthread[k].t.seed, seed[k], sizeof(seed[0]));
+      else {
+         Mthread[k].t.seed[0] = time(NULL) ^ (k * 2654435761U);
+         Mthread[k].t.seed[1] = getpid() + k;
+         Mthread[k].t.seed[2] = rand16() << 16 | rand16();
+      }
+   }
+   if(Trace) plog("miner: %d threads", n);
 
    for( ;; sleep(10)) {
       /* Running is set to 0 on SIGTERM */
@@ -62,24 +147,14 @@ int miner(char *blockin, char *blockout)
          plog("miner: beginning solve: %s block: 0x%s", blockin,
               bnum2hex(bt.bnum));
 
-      /* Create the solution state-space beginning with 
-       * the first plausible link on the TRIGG chain.
-       */
-      trigg_solve(bt.mroot, bt.difficulty[0], bt.bnum);
-
-      /* Traverse all TRIGG links to build the
-       * solution chain with trigg_generate()...
-       */
-      for(htime = time(NULL), hcount = 0; ; hcount++) {
-         if(!Running) break;
-         haiku = trigg_generate(bt.mroot, bt.difficulty[0]);
-         if(haiku != NULL) break;
-      }
+      htime = time(NULL);
+      mine(&bt, n);
       htime = time(NULL) - htime;
       if(htime == 0) htime = 1;
+      for(hcount = 0, k = 0; k < n; k++) hcount += Mthread[k].count;
       hps = hcount / htime;
       write_data(&hps, 4, "hps.dat");  /* word32 haiku per second */
-      if(!Running) break;
+      if(!Running || !Msolved) break;
 
       show("solved");
 
@@ -117,13 +192,14 @@ int miner(char *blockin, char *blockout)
          plog("miner: solved block 0x%s is now: %s",
               bnum2hex(bt.bnum), blockout);
 
-      printf("\n%s\n\n", haiku);
+      printf("\n%s\n\n", Mhaiku);
 
       break;
    }  /* end for  */
 done:
-   getrand2(temp, &temp[1], &temp[2]);
-   write_data(&temp, 12, "mseed.dat");   /* maintain rand2() sequence */
+   for(k = 0; k < n; k++)
+      memcpy(seed[k], Mthread[k].t.seed, sizeof(seed[0]));
+   write_data(seed, n * sizeof(seed[0]), "mseed.dat");  /* keep them */
    if(Trace) plog("Miner exiting...");
    return 0;
 }  /* end miner() */
@@ -4,6 +4,11 @@
  * See LICENSE.TXT   **** NO WARRANTY ****
  *
  * Date: 13 May 2018
+ *
+ * mirror() relays the TX's in Mq[] to each peer over one
+ * session from session.c, with MIRRORTHREADS peers at a time.
+ * A peer with C_INV is sent the tx_id's first in OP_INV, and gets
+ * only the TX's she asks for in OP_GETDATA.
 */
 
 
@@ -34,149 +39,285 @@ int txmap(TX *tx, word32 src_ip)
 }  /* end txmap() */
 
 
-/* Create a grandchild to send TX's in mirror.dat to ip... */
-pid_t mgc(word32 ip)
+/* The mirror queue: process_tx() in the server() thread puts each
+ * TX in Mq[] and the mirror() threads read it with no lock.  TX
+ * number n goes in slot Mq[n % MQLEN], whose seq is 2n+1 while it
+ * is written and 2n+2 once it is there.  A reader that finds seq
+ * changed under her lost the TX to a newer one and skips it.
+ */
+typedef struct {
+   volatile word32 seq;
+   byte tx_id[HASHLEN];
+   TX tx;
+} MQSLOT;
+
+MQSLOT Mq[MQLEN];
+volatile word32 Mqhead;    /* number of the next TX to put */
+word32 Mqtail;             /* first TX mirror() has not sent */
+
+/* mirror() state: read by the threads, set by server() */
+word32 Mirfirst, Mirlast;  /* TX's mirror() sends from Mq[] */
+word32 Mirpeer[RPLISTLEN]; /* who gets them */
+int Mirnpeer, Mirnext;     /* Mirnext: next Mirpeer[] to claim */
+int Mirleft;               /* threads still sending */
+int Mirnthread;
+byte Mirstop;
+byte Mqbusy;               /* mirror() has started and not stopped */
+pthread_t Mirtid[MIRRORTHREADS];
+pthread_mutex_t Mirmutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Put tx and its tx_id in Mq[].  Called by the server() thread. */
+void mq_put(TX *tx, byte *tx_id)
 {
-   pid_t pid;
-   FILE *fp;
-   long offset;
-   int lockfd, count;
-   TX mtx;
-   NODE node;
-
-   /* create grandchild */
-   pid = fork();
-   if(pid < 0) {
-      error("mgc(): Cannot fork()");
-      return 0;  /* to parent */
-   }
-   if(pid) return pid;  /* to parent */
+   MQSLOT *sp;
+   word32 n;
+
+   n = Mqhead;
+   sp = &Mq[n % MQLEN];
+   sp->seq = n * 2 + 1;
+   __sync_synchronize();
+   memcpy(sp->tx_id, tx_id, HASHLEN);
+   memcpy(&sp->tx, tx, sizeof(TX));
+   __sync_synchronize();
+   sp->seq = n * 2 + 2;
+   __sync_synchronize();
+   Mqhead = n + 1;
+}
 
-   /* in (grand) child */
-   if(Trace) plog("mgc()...");
-   show("mgc()");
 
-   fp = fopen("mirror.dat", "rb");
-   if(fp == NULL) {
-      error("mgc(): Cannot open mirror.dat");
-      exit(1);
+/* Copy TX number n from Mq[] to tx and tx_id.
+ * Returns VEOK, or VERROR if it has been written over.
+ */
+int mq_get(word32 n, TX *tx, byte *tx_id)
+{
+   MQSLOT *sp;
+   word32 seq;
+
+   sp = &Mq[n % MQLEN];
+   seq = sp->seq;
+   __sync_synchronize();
+   if(seq != n * 2 + 2) return VERROR;
+   memcpy(tx_id, sp->tx_id, HASHLEN);
+   memcpy(tx, &sp->tx, sizeof(TX));
+   __sync_synchronize();
+   if(sp->seq != seq) return VERROR;
+   return VEOK;
+}
+
+
+/* Return non-zero if ip need not get mtx. */
+int mskip(word32 ip, TX *mtx)
+{
+   /* if not in -v modes... */
+   if(Port == Dstport) {
+      /* Skip this TX if ip address is already in map. */
+      if(search32(ip, (word32 *) mtx->weight, 8)) return 1;
    }
-   offset = 0;
+   return 0;
+}
+
 
-   while(Running) {
-      lockfd = lock("mq.lck", 20);
-      if(lockfd == -1) {
-         error("mgc(): Cannot lock mq.lck"); fclose(fp); exit(1);
+/* Send mtx on np as OP_TX. */
+int msend(NODE *np, TX *mtx)
+{
+   put16(np->tx.len, 0);  /* signal not wallet to peer */
+   memcpy(TRANBUFF(&np->tx), TRANBUFF(mtx), TRANLEN);
+   /* copy ip address map to outgoing TX */
+   memcpy(np->tx.weight, mtx->weight, 32);
+   return send_op(np, OP_TX);
+}
+
+
+/* Offer the TX's from *cursor to Mirlast to a C_INV peer np in
+ * OP_INV batches and send only those she asks for with OP_GETDATA.
+ * mtx is the caller's buffer.  Returns VEOK or VERROR.
+ */
+int mgc_inv(NODE *np, word32 ip, word32 *cursor, TX *mtx)
+{
+   word32 num[INVLEN];       /* TX number of each tx_id offered */
+   byte id[INVLEN][HASHLEN];
+   byte want[INVLEN * HASHLEN];
+   byte *wp, tx_id[HASHLEN];
+   int k, n, len;
+
+   while(*cursor != Mirlast && Running && !Mirstop) {
+      for(n = 0; *cursor != Mirlast && n < INVLEN; (*cursor)++) {
+         if(mq_get(*cursor, mtx, id[n]) != VEOK) continue;
+         if(mskip(ip, mtx)) continue;
+         memcpy(TRANBUFF(&np->tx) + n * HASHLEN, id[n], HASHLEN);
+         num[n++] = *cursor;
       }
-      if(fseek(fp, offset, SEEK_SET)) {
-         unlock(lockfd); fclose(fp); exit(1);
+      if(n == 0) break;
+      put16(np->tx.len, n * HASHLEN);
+      if(send_op(np, OP_INV) != VEOK) return VERROR;
+      if(rx2(np, 1, ACK_TIMEOUT) != VEOK
+         || get16(np->tx.opcode) != OP_GETDATA) return VERROR;
+      len = get16(np->tx.len);
+      if(len > n * HASHLEN) return VERROR;
+      memcpy(want, TRANBUFF(&np->tx), len);
+      for(wp = want; len >= HASHLEN; wp += HASHLEN, len -= HASHLEN) {
+         for(k = 0; k < n; k++)
+            if(memcmp(wp, id[k], HASHLEN) == 0) break;
+         if(k >= n) continue;  /* not offered */
+         if(mq_get(num[k], mtx, tx_id) != VEOK) continue;  /* gone */
+         if(msend(np, mtx) != VEOK) return VERROR;
       }
-      /* read the TX from mirror.dat */
-      count = fread(&mtx, 1, sizeof(TX), fp);
-      /* preserve seek pos because other mgc()'s may be running */
-      offset = ftell(fp);
-      unlock(lockfd);
-      if(count != sizeof(TX)) break;
-      /* if not in -v modes... */
-      if(Port == Dstport) {
-         /* Skip this TX if ip address is already in map. */
-         if(search32(ip, (word32 *) mtx.weight, 8)) continue;
+   }
+   return VEOK;
+}  /* end mgc_inv() */
+
+
+/* Send the TX's from Mirfirst to Mirlast to ip on her session.
+ * mtx is the caller's buffer.
+ */
+void mgc(word32 ip, TX *mtx)
+{
+   NODE *np;
+   word32 cursor;
+   byte tx_id[HASHLEN];
+   int status;
+
+   /* find her first TX */
+   for(cursor = Mirfirst; cursor != Mirlast; cursor++)
+      if(mq_get(cursor, mtx, tx_id) == VEOK && !mskip(ip, mtx)) break;
+   if(cursor == Mirlast) return;  /* nothing for her */
+   np = sess_get(ip);
+   if(np == NULL) return;
+   if(np->caps & C_INV) {
+      sess_put(np, mgc_inv(np, ip, &cursor, mtx));
+      return;
+   }
+   for( ; cursor != Mirlast && Running && !Mirstop; cursor++) {
+      if(mq_get(cursor, mtx, tx_id) != VEOK || mskip(ip, mtx)) continue;
+      if(np == NULL && (np = sess_get(ip)) == NULL) return;
+      status = msend(np, mtx);
+      if(status != VEOK || (np->caps & C_STREAM) == 0) {
+         sess_put(np, status);  /* old peers take one TX per call */
+         if(status != VEOK) return;
+         np = NULL;
       }
-      if(callserver(&node, ip) != VEOK) break;
-      put16(node.tx.len, 0);  /* signal not wallet to peer */
-      memcpy(TRANBUFF(&node.tx), TRANBUFF(&mtx), TRANLEN);
-      /* copy ip address map to outgoing TX */
-      memcpy(node.tx.weight, mtx.weight, 32);
-      send_op(&node, OP_TX);
-      closesocket(node.sd);
-   }  /* end while Running */
-   fclose(fp);
-   exit(0);
+   }
+   if(np != NULL) sess_put(np, VEOK);
 }  /* end mgc() */
 
 
+/* A mirror() thread claims peers until there are none. */
+void *mirror_thread(void *arg)
+{
+   word32 ip;
+   TX *mtx;
+   char ipstr[16];
+
+   mtx = malloc(sizeof(TX));
+   for( ;; ) {
+      pthread_mutex_lock(&Mirmutex);
+      ip = 0;
+      while(ip == 0 && Mirnext < Mirnpeer) ip = Mirpeer[Mirnext++];
+      if(ip == 0 || Mirstop || mtx == NULL) {
+         Mirleft--;
+         pthread_mutex_unlock(&Mirmutex);
+         break;
+      }
+      pthread_mutex_unlock(&Mirmutex);
+      if(Trace) plog("mgc(%s)...", ntoa2((byte *) &ip, ipstr));
+      mgc(ip, mtx);
+   }
+   free(mtx);
+   ev_wake();  /* server() will stop_mirror() */
+   return NULL;
+}  /* end mirror_thread() */
+
+
 #if CPLISTLEN > RPLISTLEN
 error fix CPLISTLEN: It must be <= RPLISTLEN
 #endif
 
-/* Send tx to all current or recent peers on iplist.
- * Called from server()       --  becomes child
+byte Frisky;  /* command line switch */
+
+/* Send the TX's put in Mq[] since the last mirror() to either
+ * current or recent peers with MIRRORTHREADS threads.
+ * Called from server().
+ * Returns VEOK if started, else VERROR.
  */
-pid_t mirror1(word32 *iplist, int len)
+int mirror(void)
 {
-   pid_t pid, peer[RPLISTLEN];
+   sigset_t all, old;
    int j;
-   byte busy;
 
-   /* create child */
-   pid = fork();
-   if(pid < 0) {
-      error("mirror(): Cannot fork()");
-      return 0;
-   }
-   if(pid) return pid;  /* to parent */
-
-   /* in child */
    if(Trace) plog("mirror()...");
-   show("mirror");
-
-   shuffle32(iplist, len);  /* NOTE: can create embedded zeros. */
-   /* Create up to len mgc() grandchildren */
-   for(j = 0; j < len; j++) {
-      if(iplist[j] == 0) { peer[j] = 0; continue; }
-      peer[j] = mgc(iplist[j]);  /* grandchild */
+   if(Mqbusy) return error("mirror() already running!");
+   Mirlast = Mqhead;
+   Mirfirst = Mqtail;
+   if(Mirlast - Mirfirst > MQLEN) {
+      if(Trace) plog("mirror(): lost %u TX's", Mirlast - Mirfirst - MQLEN);
+      Mirfirst = Mirlast - MQLEN;
    }
+   Mqtail = Mirlast;
+   if(Mirfirst == Mirlast) return VEOK;
 
-   /* while Running, wait for grandchildren to finish. */
-   while(Running) {
-      busy = FALSE;
-      for(j = 0; j < len; j++) {
-         if(peer[j] == 0) continue;
-         pid = waitpid(peer[j], NULL, WNOHANG);
-         if(pid <= 0) busy = 1; else peer[j] = 0;
-      }
-      if(!busy) exit(0);
-   }  /* end while Running */
-   /* got SIGTERM */
-   for(j = 0; j < len; j++) {
-      if(peer[j]) {
-         kill(peer[j], SIGTERM);     /* Kill grandchild */
-         waitpid(peer[j], NULL, 0);  /* and burry her. */
-      }
+   if(Frisky) {
+      Mirnpeer = RPLISTLEN;
+      memcpy(Mirpeer, Rplist, sizeof(Rplist));
+   } else {
+      Mirnpeer = CPLISTLEN;
+      memcpy(Mirpeer, Cplist, sizeof(Cplist));
    }
-   exit(0);
-}  /* end mirror1() */
-
+   shuffle32(Mirpeer, Mirnpeer);  /* NOTE: can create embedded zeros. */
+   Mirnext = 0;
+   Mirstop = 0;
+
+   Mirleft = MIRRORTHREADS;
+   sigfillset(&all);
+   pthread_sigmask(SIG_BLOCK, &all, &old);  /* signals stay with us */
+   for(j = Mirnthread = 0; j < MIRRORTHREADS; j++) {
+      if(pthread_create(&Mirtid[Mirnthread], NULL,
+                        mirror_thread, NULL) != 0) break;
+      Mirnthread++;
+   }
+   pthread_sigmask(SIG_SETMASK, &old, NULL);
+   pthread_mutex_lock(&Mirmutex);
+   Mirleft -= MIRRORTHREADS - Mirnthread;  /* did not start */
+   pthread_mutex_unlock(&Mirmutex);
+   Mqbusy = 1;
+   if(Mirnthread == 0) {
+      stop_mirror();
+      return error("mirror(): no threads");
+   }
+   return VEOK;
+}  /* end mirror() */
 
-byte Frisky;  /* command line switch */
 
-/* Send tx to either current or recent peers
- * Called from server()       --  becomes child
- */
-pid_t mirror(void)
+/* Return non-zero when the mirror() threads have finished. */
+int mirror_done(void)
 {
-   if(Frisky)
-      return mirror1(Rplist, RPLISTLEN);
-   else
-      return mirror1(Cplist, CPLISTLEN);
+   int left;
+
+   pthread_mutex_lock(&Mirmutex);
+   left = Mirleft;
+   pthread_mutex_unlock(&Mirmutex);
+   return Mqbusy && left == 0;
 }
 
 
-/* kill mirror() children and grandchildren */
+/* Stop the mirror() threads and wait for them. */
 void stop_mirror(void)
 {
-   if(Mqpid) {
-      if(Trace) plog("   Reaping mirror() zombies...");
-      kill(Mqpid, SIGTERM);
-      waitpid(Mqpid, NULL, 0);
-      Mqpid = 0;
-   }
+   int j;
+
+   if(!Mqbusy) return;
+   if(Trace) plog("   Stopping mirror() threads...");
+   Mirstop = 1;
+   for(j = 0; j < Mirnthread; j++)
+      pthread_join(Mirtid[j], NULL);
+   Mirnthread = 0;
+   Mqbusy = 0;
 }  /* end stop_mirror() */
 
 
 /* Called by gettx()  -- in parent
  *
- * Validate a TX, write clean TX to txq1.dat, and raw TX to mq.dat.
+ * Validate a TX, write clean TX to txq1.dat, and raw TX to Mq[].
  * txq1.lck is locked during file access.
  */
 int process_tx(NODE *np)
@@ -234,26 +375,10 @@ int process_tx(NODE *np)
    fclose(fp);      /* close txq1.dat */
    unlock(lockfd);  /* unlock txq1.lck */
 
-   /* lock mirror file */
-   lockfd = lock("mq.lck", 20);
-   if(lockfd == -1) {
-      error("Cannot lock mq.lck");  /* should not happen */
-      return 1;
-   }
-   fp = fopen("mq.dat", "ab");
-   if(!fp) goto bad;
-   ecode = 0;
    /* fill in mirror address map */
-   if(txmap(tx, np->src_ip) == VEOK) {
-      count = fwrite(tx, 1, sizeof(TX), fp);
-      if(count != sizeof(TX)) {
-         error("bad write on mq.dat");
-         ecode = 1;
-      } else Mqcount++;
-   }
-   fclose(fp);      /* close mq.dat */
-   unlock(lockfd);  /* unlock mq.lck */
-   return ecode;
+   if(txmap(tx, np->src_ip) == VEOK)
+      mq_put(tx, tx_id);  /* for mirror() */
+   return 0;
 
 bad:
    unlock(lockfd);
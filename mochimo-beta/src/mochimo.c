@@ -31,12 +31,15 @@
 /* Server control */
 #include "util.c"       /* server support */
 #include "sock.c"       /* inet utilities */
+#include "blockrd.c"    /* mmap block reader */
 #include "pink.c"       /* manage pinklist                 */
 #include "connect.c"    /* make outgoing connection        */
 #include "call.c"       /* callserver() and friends        */
+#include "session.c"    /* long-lived peer connections     */
+#include "sync.c"       /* parallel download for get_eon() */
 #include "ledger.c"
 #include "tag.c"        /* address tag support             */
-#include "gettx.c"      /* poll and read NODE socket       */
+#include "gettx.c"      /* check and answer NODE packets   */
 #include "txval.c"      /* validate transactions           */
 #include "mirror.c"
 #include "execute.c"
@@ -48,6 +51,9 @@
 #include "miner.c"
 #include "update.c"
 #include "init.c"       /* read Coreplist[] and SYNC       */
+#include "local.c"      /* local query socket              */
+#include "evloop.c"     /* event loop for server()         */
+#include "pool.c"       /* worker threads for execute()    */
 #include "server.c"     /* tcp server                      */
 
 
@@ -65,10 +71,12 @@ void usage(void)
           "         -d         disable pink lists\n"
           "         -pN        set port to N\n"
           "         -D         Daemon ignore ctrl-c and no term output\n"
-          "         -sN        sleep N usec. on each loop if not busy\n"
+          "         -sN        wait N usec. at most for events on each loop\n"
           "         -xxxxxxx   replace xxxxxxx with state\n"
           "         -f         frisky mode (promiscuous mirroring)\n"
           "         -S         Safe mode\n"
+          "         -mN        mine with N threads (default 1)\n"
+          "         -m         mine with a thread per CPU\n"
    );
    exit(0);
 }
@@ -134,12 +142,15 @@ int main(int argc, char **argv)
                     break;
          case 'S':  Safemode = 1;
                     break;
+         case 'm':  Nminers = atoi(&argv[j][2]);  /* miner threads */
+                    if((unsigned) Nminers > MAXMINERS) usage();
+                    break;
          case 'x':  if(strlen(argv[j]) != 8) break;
                     Statusarg = argv[j];
                     break;
          case 'D':  Bgflag = 1;
                     break;
-         case 's':  Dynasleep = atoi(&argv[j][2]);  /* usleep time */
+         case 's':  Dynasleep = atoi(&argv[j][2]);  /* ev_wait() time */
                     break;
          case 'V':  if(strcmp(&argv[j][1], "Veronica") == 0)
                        veronica();
@@ -161,6 +172,7 @@ int main(int argc, char **argv)
     */
    fix_signals();
    signal(SIGCHLD, SIG_DFL);  /* so waitpid() works */
+   Mainthread = pthread_self();  /* for inworker() */
 
    init();  /* Initialise -- does not fork() */
    printf("\n");
@@ -66,6 +66,7 @@
 #endif
 
 #include "wots/wots.h"
+#include "trigg/trigg.h"
 #include "types.h"
 
 #endif  /* MOCHIMO_H */
@@ -21,6 +21,7 @@
 #include "add64.c"
 #include "util.c"
 #include "daemon.c"
+#include "blockrd.c"
 
 
 void bail(char *message)
@@ -36,6 +37,7 @@ void bail(char *message)
 int main(int argc, char **argv)
 {
    static BTRAILER bt, nbt;
+   static BLOCKRD br;
    word32 hdrlen;      /* header length for neo block */
    word32 llen;        /* ledger length */
    SHA256_CTX bctx;
@@ -61,8 +63,10 @@ int main(int argc, char **argv)
       bail("Cblocknum has bad modulus");
 
    /* read trailer from  b...ff block */
-   if(readtrailer(&bt, argv[1]) != VEOK)
+   if(br_open(&br, argv[1]) != VEOK)
       bail("bad trailer read");
+   memcpy(&bt, br.bt, sizeof(BTRAILER));
+   br_close(&br);
    if(bt.bnum[0] != 0xff)
       bail("bt.bnum has bad modulus");
    if(memcmp(bt.bnum, Cblocknum, 8) != 0)
@@ -4,20 +4,129 @@
  * See LICENSE.TXT   **** NO WARRANTY ****
  *
  * Date: 9 January 2018
+ *
+ * Revised 19 October 2026: the current, last, and epoch pink lists
+ * are flags in one hashed table of IP's, Iptab[], which also holds
+ * a token bucket for connections and one for requests from each IP.
+ * An IP hashes to a set of IPWAYS slots; when the set is full, the
+ * IP that has been quiet longest gives up her slot, pink ones last,
+ * so a flood of new IP's cannot push out the old offenders.
+ *
+ * Going over a rate only gets that connection or request refused:
+ * it never pink-lists.  Peers on Rplist[] or Cplist[] are not rated.
+ * Block fetches (OP_GETBLOCK and friends) have a bucket of their own,
+ * and a connection that opens with one gets its connection token
+ * back, so a peer syncing from us one connection per block is held
+ * to GETRATE only.  Syncing is paced by validating each block, far
+ * below that.
+ *
+ * Build self-test of a sync with the limits on:
+ *    cc -DUNIXLIKE -DLONG64 -DTESTPINK -o pink pink.c -lpthread
 */
 
+#ifdef TESTPINK
+#include "config.h"
+#include "mochimo.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+time_t Ltime;
+byte Disable_pink;
+word32 Trace, Rplist[RPLISTLEN], Rplistidx, Cplist[CPLISTLEN], Cplistidx;
+word32 Npink;  /* pinklist() calls */
+void plog(char *fmt, ...) { }
+char *ntoa(byte *a) { return ""; }
+word32 *search32(word32 val, word32 *list, unsigned len)
+{
+   for( ; len; len--, list++) if(*list == val) return list;
+   return NULL;
+}
+int remove32(word32 bad, word32 *list, unsigned maxlen) { Npink++;  return 0; }
+#endif
+
+#include <pthread.h>
+
+#define P_CURRENT  1   /* pink flags */
+#define P_LAST     2
+#define P_EPOCH    4
+
+#define IP_OP      0   /* ipallow() kind: a request */
+#define IP_CONN    1   /* a connection */
+#define IP_GET     2   /* a block fetch request */
+
+typedef struct {
+   word32 ip;        /* zero if slot is free */
+   word16 conns;     /* tokens: connections she may open */
+   word16 ops;       /* tokens: requests she may send */
+   word16 gets;      /* tokens: blocks she may fetch */
+   byte pink;        /* P_CURRENT | P_LAST | P_EPOCH */
+   byte strikes;     /* refused for rate, since pink list merge */
+   time_t last;      /* when tokens were last added */
+} IPREC;
+
+IPREC Iptab[IPTABLEN];
+pthread_mutex_t Pinkmutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Return ip's slot in Iptab[], or if add is non-zero, a new one.
+ * Returns NULL if not found, or the set is all pink and busy.
+ * Caller holds Pinkmutex.
+ */
+IPREC *iprec(word32 ip, int add)
+{
+   IPREC *set, *rp, *old;
+   word32 j;
+
+   if(ip == 0) return NULL;
+   j = (ip * 2654435761U) >> 16;  /* Fibonacci hash */
+   set = &Iptab[(j & (IPTABLEN / IPWAYS - 1)) * IPWAYS];
+   old = NULL;
+   for(rp = set; rp < &set[IPWAYS]; rp++) {
+      if(rp->ip == ip) return rp;
+      if(!add) continue;
+      /* give up a free slot, else one not pink, else the quietest */
+      if(old == NULL) old = rp;
+      else if(old->ip == 0) continue;
+      else if(rp->ip == 0 || (rp->pink == 0 && old->pink != 0)) old = rp;
+      else if((rp->pink == 0) == (old->pink == 0) && rp->last < old->last)
+         old = rp;
+   }
+   if(old == NULL) return NULL;
+   memset(old, 0, sizeof(IPREC));
+   old->ip = ip;
+   old->conns = CONNBURST;
+   old->ops = OPBURST;
+   old->gets = GETBURST;
+   old->last = Ltime;
+   return old;
+}  /* end iprec() */
+
+
+/* Set flag on ip. */
+void setpink(word32 ip, int flag)
+{
+   IPREC *rp;
+
+   pthread_mutex_lock(&Pinkmutex);
+   rp = iprec(ip, 1);
+   if(rp != NULL) rp->pink |= flag;
+   pthread_mutex_unlock(&Pinkmutex);
+}
 
-/* pink lists of EVIL IP addresses read in from disk */
-word32 Cpinklist[CPINKLEN];
-word32 Lpinklist[LPINKLEN];
-word32 Epinklist[EPINKLEN];
-word32 Cpinkidx, Lpinkidx, Epinkidx;
 
 /* Re-read epoch pink list from init(). */
 int readpink(void)
 {
+   FILE *fp;
+   word32 ip;
+
    if(Trace) plog("reading epoch pink list...");
-   return readlist32(Epinklist, 4, EPINKLEN, "epink.lst", &Epinkidx);
+   fp = fopen("epink.lst", "rb");
+   if(fp == NULL) return VEOK;
+   while(fread(&ip, 4, 1, fp) == 1)
+      if(ip) setpink(ip, P_EPOCH);
+   fclose(fp);
+   return VEOK;
 }
 
 
@@ -26,28 +135,34 @@ int readpink(void)
  */
 int savepink(void)
 {
-   int j;
+   FILE *fp;
+   IPREC *rp;
 
    if(Trace) plog("saving epoch pink list...");
 
-   /* save non-zero entries */
-   for(j = 0; j < EPINKLEN; j++)
-      if(Epinklist[j] == 0) break;
-
-   write_data(Epinklist, j * 4, "epink.lst");
+   fp = fopen("epink.lst", "wb");
+   if(fp == NULL) return VERROR;
+   pthread_mutex_lock(&Pinkmutex);
+   for(rp = Iptab; rp < &Iptab[IPTABLEN]; rp++)
+      if(rp->ip && (rp->pink & P_EPOCH)) fwrite(&rp->ip, 4, 1, fp);
+   pthread_mutex_unlock(&Pinkmutex);
+   fclose(fp);
    return VEOK;
 }  /* end savepink() */
 
 
 int pinklisted(word32 ip)
 {
+   IPREC *rp;
+   int pink;
+
    if(Disable_pink) return 0;   /* for debug @ */
 
-   if(search32(ip, Cpinklist, CPINKLEN) != NULL
-      || search32(ip, Lpinklist, LPINKLEN) != NULL
-      || search32(ip, Epinklist, EPINKLEN) != NULL)
-         return 1;
-   return 0;
+   pthread_mutex_lock(&Pinkmutex);
+   rp = iprec(ip, 0);
+   pink = rp != NULL && rp->pink != 0;
+   pthread_mutex_unlock(&Pinkmutex);
+   return pink;
 }
 
 
@@ -56,9 +171,7 @@ int pinklisted(word32 ip)
  */
 int cpinklist(word32 ip)
 {
-   if(Cpinkidx >= CPINKLEN)
-      Cpinkidx = 0;
-   Cpinklist[Cpinkidx++] = ip;
+   setpink(ip, P_CURRENT);
    return VEOK;
 }
 
@@ -71,11 +184,7 @@ int pinklist(word32 ip)
    if(Trace)
       plog("%s pink-listed", ntoa((byte *) &ip));
 
-   if(!pinklisted(ip)) {
-      if(Cpinkidx >= CPINKLEN)
-         Cpinkidx = 0;
-      Cpinklist[Cpinkidx++] = ip;
-   }
+   setpink(ip, P_CURRENT);
    if(!Disable_pink) {
       if(remove32(ip, Rplist, RPLISTLEN)) {
          if(Rplistidx >= RPLISTLEN) Rplistidx = 0;
@@ -95,49 +204,168 @@ int pinklist(word32 ip)
  */
 int lpinklist(word32 ip)
 {
-   if(Lpinkidx >= LPINKLEN)
-      Lpinkidx = 0;
-   Lpinklist[Lpinkidx++] = ip;
+   setpink(ip, P_LAST);
    return VEOK;
 }
 
 
 int epinklist(word32 ip)
 {
-   if(Epinkidx >= EPINKLEN) {
-      if(Trace) plog("Epoch pink list overflow");
-      Epinkidx = 0;
-   }
-   Epinklist[Epinkidx++] = ip;
+   setpink(ip, P_EPOCH);
    return VEOK;
 }
 
 
+/* Add the tokens rp has earned since rp->last.  Caller holds Pinkmutex. */
+void ipfill(IPREC *rp)
+{
+   word32 n, t;
+
+   if(Ltime <= rp->last) return;
+   t = Ltime - rp->last;
+   if(t > 3600) t = 3600;  /* full by then */
+   n = rp->conns + t * CONNRATE;
+   rp->conns = n > CONNBURST ? CONNBURST : n;
+   n = rp->ops + t * OPRATE;
+   rp->ops = n > OPBURST ? OPBURST : n;
+   n = rp->gets + t * GETRATE;
+   rp->gets = n > GETBURST ? GETBURST : n;
+   rp->last = Ltime;
+}
+
+
+/* Take a token from ip's bucket for kind: IP_CONN, IP_OP, or IP_GET.
+ * Returns 1 if she may go on, or 0 if she is over her rate and this
+ * connection or request should be dropped.  Called from the server()
+ * thread.
+ */
+int ipallow(word32 ip, int kind)
+{
+   IPREC *rp;
+   word32 n;
+   int ok;
+
+   if(Disable_pink) return 1;
+   if(search32(ip, Rplist, RPLISTLEN) || search32(ip, Cplist, CPLISTLEN))
+      return 1;  /* our peers */
+
+   pthread_mutex_lock(&Pinkmutex);
+   rp = iprec(ip, 1);
+   if(rp == NULL) {
+      pthread_mutex_unlock(&Pinkmutex);
+      return 1;  /* no room to keep score */
+   }
+   ipfill(rp);
+   if(kind == IP_CONN) ok = rp->conns ? rp->conns-- : 0;
+   else if(kind == IP_GET) ok = rp->gets ? rp->gets-- : 0;
+   else ok = rp->ops ? rp->ops-- : 0;
+   if(!ok && rp->strikes < 255) rp->strikes++;
+   n = rp->strikes;
+   pthread_mutex_unlock(&Pinkmutex);
+   if(ok) return 1;
+   if(Trace && n == 1) plog("%s over %s rate", ntoa((byte *) &ip),
+                            kind == IP_CONN ? "connection"
+                            : kind == IP_GET ? "block fetch" : "request");
+   return 0;
+}  /* end ipallow() */
+
+
+/* Give back the connection token ip spent on a connection that
+ * turned out to be a block fetch.  Called from the server() thread.
+ */
+void iprefund(word32 ip)
+{
+   IPREC *rp;
+
+   pthread_mutex_lock(&Pinkmutex);
+   rp = iprec(ip, 0);
+   if(rp != NULL && rp->conns < CONNBURST) rp->conns++;
+   pthread_mutex_unlock(&Pinkmutex);
+}
+
+
 /* Call after each epoch.
  * Merges current pink list into last pink list
  * and purges current pink list.
  */
 void mergepinklists(void)
 {
-   int j;
-   word32 ip, *ptr;
+   IPREC *rp;
 
-   for(j = 0; j < CPINKLEN; j++) {
-      ip = Cpinklist[j];
-      if(ip == 0) continue;  /* empty */
-      ptr = search32(ip, Lpinklist, LPINKLEN);
-      if(ptr == NULL) lpinklist(ip);  /* add to last bad list */
-      Cpinklist[j] = 0;
+   pthread_mutex_lock(&Pinkmutex);
+   for(rp = Iptab; rp < &Iptab[IPTABLEN]; rp++) {
+      if(rp->pink & P_CURRENT) rp->pink = (rp->pink & ~P_CURRENT) | P_LAST;
+      rp->strikes = 0;
    }
-   Cpinkidx = 0;
+   pthread_mutex_unlock(&Pinkmutex);
 }
 
 
-/* Erase Epoch Pink List */
+/* Erase Epoch Pink List, and the last pink list with it:
+ * it no longer wraps around at LPINKLEN.
+ */
 void purge_epoch(void)
 {
+   IPREC *rp;
+
    if(Trace) plog("   purging epoch pink list");
    unlink("epink.lst");
-   memset(Epinklist, 0, sizeof(Epinklist));
-   Epinkidx = 0;
+   pthread_mutex_lock(&Pinkmutex);
+   for(rp = Iptab; rp < &Iptab[IPTABLEN]; rp++)
+      rp->pink &= ~(P_EPOCH | P_LAST);
+   pthread_mutex_unlock(&Pinkmutex);
+}
+
+
+#ifdef TESTPINK
+
+/* One block fetch as evloop.c sees it: a connection, then a
+ * first request that is OP_GETBLOCK.  Returns 1 if both allowed.
+ */
+int fetch(word32 ip)
+{
+   if(!ipallow(ip, IP_CONN)) return 0;
+   iprefund(ip);
+   return ipallow(ip, IP_GET);
 }
+
+int main(void)
+{
+   word32 sync_ip, relay_ip, flood_ip;
+   long j, blocks, refused, relayed, flooded;
+   int ecode;
+
+   ecode = 0;
+   sync_ip = 0x0a000001;
+   relay_ip = 0x0a000002;
+   flood_ip = 0x0a000003;
+   Rplist[0] = relay_ip;
+   Ltime = time(NULL);
+
+   /* sync 200000 blocks at 250 a second from a node not on our lists */
+   for(blocks = refused = 0; blocks < 200000; Ltime++)
+      for(j = 0; j < 250; j++, blocks++) refused += !fetch(sync_ip);
+   printf("sync:  %ld blocks, %ld refused, pink %d\n", blocks, refused,
+          pinklisted(sync_ip));
+   if(refused || pinklisted(sync_ip)) ecode = 1;
+
+   /* a recent peer relays 5000 TX's in a second, one connection each */
+   for(j = relayed = 0; j < 5000; j++)
+      relayed += ipallow(relay_ip, IP_CONN) && ipallow(relay_ip, IP_OP);
+   printf("relay: %ld of 5000 allowed, pink %d\n", relayed,
+          pinklisted(relay_ip));
+   if(relayed != 5000 || pinklisted(relay_ip)) ecode = 1;
+
+   /* a stranger floods: refused past the burst, but not pink-listed */
+   for(j = flooded = 0; j < 100000; j++)
+      flooded += ipallow(flood_ip, IP_CONN);
+   printf("flood: %ld of 100000 allowed, pink %d\n", flooded,
+          pinklisted(flood_ip));
+   if(flooded != CONNBURST || pinklisted(flood_ip)) ecode = 1;
+
+   if(Npink) ecode = 1;
+   printf("%s\n", ecode ? "FAIL" : "ok");
+   return ecode;
+}  /* end main() */
+
+#endif  /* TESTPINK */
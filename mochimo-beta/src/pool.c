@@ -0,0 +1,160 @@
+/* pool.c  Worker threads for execute()
+ *
+ * Copyright (c) 2018 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.TXT   **** NO WARRANTY ****
+ *
+ * The Mochimo Project System Software
+ *
+ * Date: 19 October 2026
+ *
+ * Requests that take more than one packet -- OP_GETBLOCK, OP_GET_TFILE,
+ * OP_GET_TRAILERS, and OP_FOUND -- are queued by serve() as a JOB,
+ * and one of NWORKER threads runs execute() on it.  Each JOB carries
+ * its own NODE, so nothing else is copied.  When execute() returns,
+ * the worker puts the JOB on the done list and writes the SIGCHLD
+ * pipe in evloop.c, and server() collects it with pool_done() as it
+ * once reaped a child.
+ *
+ * Workers must leave the peer and pink lists to server().
+ * The downloaders in sync.c are workers too in this sense.
+*/
+
+#include <pthread.h>
+
+typedef struct JOB {
+   NODE node;           /* request from gettx() */
+   int status;          /* execute() return: 0-3 */
+   struct JOB *next;
+} JOB;
+
+JOB *Jobq;              /* waiting for a worker */
+JOB **Jobqtail = &Jobq;
+JOB *Jobdone;           /* waiting for server() */
+int Nworker;            /* threads started */
+byte Poolstop;
+pthread_mutex_t Poolmutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Poolcond = PTHREAD_COND_INITIALIZER;
+pthread_t Mainthread;
+
+
+/* Return non-zero if not called from the main() thread,
+ * which main() saves in Mainthread.
+ */
+int inworker(void)
+{
+   return !pthread_equal(pthread_self(), Mainthread);
+}
+
+
+void *worker(void *arg)
+{
+   JOB *jp;
+
+   for( ;; ) {
+      pthread_mutex_lock(&Poolmutex);
+      while(Jobq == NULL && !Poolstop)
+         pthread_cond_wait(&Poolcond, &Poolmutex);
+      jp = Jobq;
+      if(jp != NULL) {
+         Jobq = jp->next;
+         if(Jobq == NULL) Jobqtail = &Jobq;
+      }
+      pthread_mutex_unlock(&Poolmutex);
+      if(jp == NULL) break;  /* Poolstop */
+
+      jp->status = execute(&jp->node);
+
+      pthread_mutex_lock(&Poolmutex);
+      jp->next = Jobdone;
+      Jobdone = jp;
+      pthread_mutex_unlock(&Poolmutex);
+      write(Sigpipe[1], "j", 1);  /* wake ev_wait() */
+   }
+   return NULL;
+}  /* end worker() */
+
+
+/* Start NWORKER threads.  Signals stay with server().
+ * Returns VEOK, or VERROR if no thread would start.
+ */
+int pool_start(void)
+{
+   pthread_t tid;
+   sigset_t all, old;
+   int j;
+
+   Poolstop = 0;
+   sigfillset(&all);
+   pthread_sigmask(SIG_BLOCK, &all, &old);
+   for(j = Nworker = 0; j < NWORKER; j++) {
+      if(pthread_create(&tid, NULL, worker, NULL) != 0) continue;
+      pthread_detach(tid);
+      Nworker++;
+   }
+   pthread_sigmask(SIG_SETMASK, &old, NULL);
+   if(Trace) plog("pool_start(): %d workers", Nworker);
+   return Nworker ? VEOK : VERROR;
+}  /* end pool_start() */
+
+
+/* Queue np for a worker.  The JOB owns np->sd from here.
+ * Returns VEOK, or VERROR if the queue is full or out of memory
+ * (caller closes the socket).
+ */
+int pool_submit(NODE *np)
+{
+   JOB *jp;
+
+   if(Nonline >= MAXJOBS) {
+      Nspace++;
+      return VERROR;
+   }
+   jp = malloc(sizeof(JOB));
+   if(jp == NULL) return error("pool_submit(): no memory");
+   memcpy(&jp->node, np, sizeof(NODE));
+   jp->status = 1;
+   jp->next = NULL;
+   pthread_mutex_lock(&Poolmutex);
+   *Jobqtail = jp;
+   Jobqtail = &jp->next;
+   pthread_cond_signal(&Poolcond);
+   pthread_mutex_unlock(&Poolmutex);
+   Nonline++;
+   return VEOK;
+}  /* end pool_submit() */
+
+
+/* Return a finished JOB for server() to free(), or NULL. */
+JOB *pool_done(void)
+{
+   JOB *jp;
+
+   pthread_mutex_lock(&Poolmutex);
+   jp = Jobdone;
+   if(jp != NULL) Jobdone = jp->next;
+   pthread_mutex_unlock(&Poolmutex);
+   if(jp != NULL) Nonline--;
+   return jp;
+}
+
+
+/* Stop the workers once they finish.  Requests still queued are
+ * dropped.  Workers busy in execute() see Running == 0 and end with
+ * the process.
+ */
+void pool_stop(void)
+{
+   JOB *jp;
+
+   pthread_mutex_lock(&Poolmutex);
+   Poolstop = 1;
+   while((jp = Jobq) != NULL) {
+      Jobq = jp->next;
+      closesocket(jp->node.sd);
+      free(jp);
+      Nonline--;
+   }
+   Jobqtail = &Jobq;
+   pthread_cond_broadcast(&Poolcond);
+   pthread_mutex_unlock(&Poolmutex);
+}  /* end pool_stop() */
@@ -12,43 +12,81 @@ int write_data(void *buff, int len, char *fname);
 
 /* Source file: update.c */
 int send_found(void);
+void found_stop(void);
 void wait_tx(void);
 int update(char *fname, int mode);
 
 /* Source file: gettx.c */
-int freeslot(NODE *np);
+void statinc(word32 *cp);
 int sendtx(NODE *np);
+int sendtx2(NODE *np, byte *bnum, byte *bhash, byte *phash);
 int send_op(NODE *np, int opcode);
 int check_contention(NODE *np);
-int gettx(NODE *np, SOCKET sd);
-NODE *getslot(NODE *np);
+int gethello(NODE *np);
+int gettx(NODE *np);
 
 /* Source file: execute.c */
 int process_tx(NODE *np);
 int sendnack(NODE *np);
+void bcname(char *fname, byte *bnum);
 int send_file(NODE *np, char *fname);
+int send_bulk(NODE *np);
 int send_ipl(NODE *np);
+int send_getdata(NODE *np);
 int copy_rec_ipl(TX *tx);
 int execute(NODE *np);
 
 /* Source file: contend.c */
 int rx2(NODE *np, int checkids, int seconds);
+word32 rand16t(void);
 int callserver(NODE *np, word32 ip);
+int callserver2(NODE *np, word32 ip, int seconds);
 int get_tx2(NODE *np, word32 ip, word16 opcode);
+int rx_bulk(NODE *np, byte *bnum, FILE *fp);
 int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode);
 int contend(word32 ip);
 
+/* Source file: session.c */
+NODE *sess_get(word32 ip);
+NODE *sess_get2(word32 ip, int seconds);
+void sess_put(NODE *np, int status);
+void sess_expire(void);
+void sess_close(void);
+
+/* Source file: sync.c */
+int sync_start(word32 *gang, int ngang, byte *first, byte *last);
+int sync_next(byte *bnum, char *fname, word32 *ip);
+void sync_stop(void);
+
 /* Source file: init.c */
 int read_coreipl(char *fname);
 word32 init_coreipl(NODE *np, char *fname);
 void add_weight(byte *weight, int difficulty);
 int append_tfile(char *fname, char *tfile);
+int tfstart(TFSTATE *st);
+void *tfval_thread(void *arg);
+void tfval_par(BTRAILER *bt, byte *ok, int n);
+int tfval_run(FILE *fp, TFSTATE *st, byte *stop, int weight_only);
+FILE *tfopen(char *fname, int *result);
+int tfhash(FILE *fp, SHA256_CTX *ctx, long len);
+int tfresume(FILE *fp, TFSTATE *st, byte *stop, SHA256_CTX *ctx);
+int tfcheck(TFSTATE *st, SHA256_CTX *ctx);
 byte *tfval(char *fname, byte *highblock, int weight_only, int *result);
+int tfstate(byte *bnum, TFSTATE *st);
+byte *tfval_tail(word32 ip, byte *bnum, byte *highblock);
 int get_eon(NODE *np, word32 peerip);
 int init(void);
-void trigg_solve(byte *link, int diff, byte *bnum);
-char *trigg_generate(byte *in, int diff);
-char *trigg_check(byte *in, byte d, byte *bnum);
 
+/* Source file: pool.c */
+int inworker(void);
+int pool_submit(NODE *np);
+
+/* Source file: server.c */
+void serve(NODE *np, int status);
+
+int mirror(void);
+int mirror_done(void);
 void stop_mirror(void);
+void ev_wake(void);
 int send_balance(NODE *np);
+int send_balances(NODE *np);
@@ -15,9 +15,7 @@
 
 /* Default initial seed for random generator */
 static word32 Lseed = 1;
-static word32 Lseed2 = 1;
-static word32 Lseed3 = 362436069;
-static word32 Lseed4 = 123456789;
+static word32 Lseed2[3] = { 1, 362436069, 123456789 };  /* rand2() */
 
 /* Seed the generator */
 word32 srand16(word32 x)
@@ -37,17 +35,17 @@ word32 getrand16(void)
 
 void srand2(word32 x, word32 y, word32 z)
 {
-   Lseed2 = x;
-   Lseed3 = y;
-   Lseed4 = z;
+   Lseed2[0] = x;
+   Lseed2[1] = y;
+   Lseed2[2] = z;
 }
 
 /* Return random seed to caller */
 void getrand2(word32 *x, word32 *y, word32 *z)
 {
-   *x = Lseed2;
-   *y = Lseed3;
-   *y = Lseed4;
+   *x = Lseed2[0];
+   *y = Lseed2[1];
+   *y = Lseed2[2];
 }
 
 /* Period: 2**32 randl4() -- returns 0-65535 */
@@ -58,17 +56,26 @@ word32 rand16(void)
 }
 
 
-/* Based on Dr. Marsaglia's Usenet post */
+/* Based on Dr. Marsaglia's Usenet post
+ * rand2() with its state in seed[3], for threads that each want
+ * their own sequence.  See trigg/trigg.h.
+ */
+word32 rand2r(word32 *seed)
+{
+   seed[0] = seed[0] * 69069L + 262145L;  /* LGC */
+   if(seed[1] == 0) seed[1] = 362436069;
+   seed[1] = 36969 * (seed[1] & 65535) + (seed[1] >> 16);  /* MWC */
+   if(seed[2] == 0) seed[2] = 123456789;
+   seed[2] ^= (seed[2] << 17);
+   seed[2] ^= (seed[2] >> 13);
+   seed[2] ^= (seed[2] << 5);  /* LFSR */
+   return (seed[0] ^ (seed[1] << 16) ^ seed[2]) >> 16;
+}
+
+
 word32 rand2(void)
 {
-   Lseed2 = Lseed2 * 69069L + 262145L;  /* LGC */
-   if(Lseed3 == 0) Lseed3 = 362436069;
-   Lseed3 = 36969 * (Lseed3 & 65535) + (Lseed3 >> 16);  /* MWC */
-   if(Lseed4 == 0) Lseed4 = 123456789;
-   Lseed4 ^= (Lseed4 << 17);
-   Lseed4 ^= (Lseed4 >> 13);
-   Lseed4 ^= (Lseed4 << 5);  /* LFSR */
-   return (Lseed2 ^ (Lseed3 << 16) ^ Lseed4) >> 16;
+   return rand2r(Lseed2);
 }
 
 
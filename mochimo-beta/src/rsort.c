@@ -0,0 +1,441 @@
+/* rsort.c  Radix sort for fixed-width record keys
+ *
+ * Copyright (c) 2018 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.TXT   **** NO WARRANTY ****
+ *
+ * The Mochimo Project System Software
+ *
+ * Date: 19 October 2026
+ *
+ * Sorts a word32 index array, as shell() in sort.c does, on a key of
+ * keylen bytes at keyoff in each reclen-byte record of base[].
+ * base[] may be an mmap'd record file.  Keys compare as memcmp() does
+ * and the sort is stable.  rs_permute() then puts the records
+ * themselves in sorted order, in place.
+ *
+ * Short keys are sorted LSD, long keys MSD; MSD buckets smaller
+ * than RSSMALL are finished with an insertion sort.
+ * A caller may supply keyfn() to locate keys that are not simply
+ * at base + idx * reclen + keyoff.
+ *
+ * rsort() runs in the calling thread unless a caller opts in by
+ * setting Rsort_threads to more than 1: then with at least RSPARMIN
+ * records the top-level MSD buckets are sorted by a team of threads.
+ * Rsort_threads == 0 picks one thread per on-line CPU.
+ * rsort() keeps no static state and may run in several threads at once.
+ *
+ * Build benchmark against shell():
+ *    cc -DUNIXLIKE -DLONG64 -DTESTRSORT -o rsort rsort.c -lpthread
+*/
+
+#ifdef TESTRSORT
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#define VEOK 0
+#define VERROR 1
+#endif
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define RSSMALL   32       /* insertion sort buckets below this size */
+#define RSLSDMAX  8        /* LSD for keys up to this many bytes */
+#define RSPARMIN  65536    /* fewest records worth a thread team */
+#define RSMAXTHREADS 64
+
+#define RS_AUTO   0        /* RSORT.mode */
+#define RS_LSD    1
+#define RS_MSD    2
+
+typedef struct RSORT {
+   byte *base;       /* record array -- may be an mmap'd file */
+   size_t reclen;    /* bytes per record */
+   size_t keyoff;    /* offset of key in record */
+   size_t keylen;    /* key width in bytes */
+   int mode;         /* RS_AUTO, RS_LSD, or RS_MSD */
+   /* optional key extractor: NULL means base + idx * reclen + keyoff */
+   byte *(*keyfn)(struct RSORT *rs, word32 idx);
+   void *arg;        /* for keyfn() */
+} RSORT;
+
+typedef struct {
+   word32 lo, hi;    /* index range [lo, hi) */
+   word32 depth;     /* key byte to sort on */
+} RSSEG;
+
+typedef struct {
+   RSORT *rs;
+   word32 *idx, *tmp;
+   word32 *bucket;   /* bucket boundaries: bucket[b] ... bucket[b+1] */
+   int next;         /* next bucket to claim */
+   int ecode;
+   pthread_mutex_t mutex;
+} RSTEAM;
+
+int Rsort_threads = 1;   /* > 1 for a thread team, 0 = one per CPU */
+
+
+#define RSKEY(rs, i) \
+   ((rs)->keyfn ? (rs)->keyfn((rs), (i)) \
+                : (rs)->base + (size_t) (i) * (rs)->reclen + (rs)->keyoff)
+
+
+/* Stable insertion sort of idx[lo..hi-1] on key bytes depth...keylen-1 */
+static void rs_insert(RSORT *rs, word32 *idx, word32 lo, word32 hi,
+                      size_t depth)
+{
+   word32 j, k, temp;
+   size_t len;
+   byte *key;
+
+   len = rs->keylen - depth;
+   for(j = lo + 1; j < hi; j++) {
+      temp = idx[j];
+      key = RSKEY(rs, temp) + depth;
+      for(k = j; k > lo
+          && memcmp(RSKEY(rs, idx[k - 1]) + depth, key, len) > 0; k--)
+         idx[k] = idx[k - 1];
+      idx[k] = temp;
+   }
+}  /* end rs_insert() */
+
+
+/* Length of the key prefix common to all of idx[lo..hi-1],
+ * given that the first depth bytes are already known to be common.
+ */
+static size_t rs_common(RSORT *rs, word32 *idx, word32 lo, word32 hi,
+                        size_t depth)
+{
+   size_t n;
+   word32 j;
+   byte *first, *key;
+
+   n = rs->keylen;
+   first = RSKEY(rs, idx[lo]);
+   for(j = lo + 1; j < hi && n > depth; j++) {
+      key = RSKEY(rs, idx[j]);
+      if(memcmp(first + depth, key + depth, n - depth) == 0) continue;
+      for(n = depth; first[n] == key[n]; n++);
+   }
+   return n;
+}  /* end rs_common() */
+
+
+/* Distribute idx[lo..hi-1] on key byte depth through tmp[lo..hi-1].
+ * Fills count[0..256] with bucket start offsets and returns the
+ * number of non-empty buckets.
+ */
+static int rs_pass(RSORT *rs, word32 *idx, word32 *tmp, word32 lo, word32 hi,
+                   size_t depth, word32 *count)
+{
+   word32 j, pos[256];
+   int b, nb;
+
+   memset(count, 0, 257 * sizeof(word32));
+   for(j = lo; j < hi; j++)
+      count[RSKEY(rs, idx[j])[depth] + 1]++;
+   for(b = nb = 0; b < 256; b++) {
+      if(count[b + 1]) nb++;
+      count[b + 1] += count[b];
+   }
+   if(nb < 2) return nb;
+   for(b = 0; b < 256; b++) pos[b] = lo + count[b];
+   for(j = lo; j < hi; j++)
+      tmp[pos[RSKEY(rs, idx[j])[depth]]++] = idx[j];
+   memcpy(&idx[lo], &tmp[lo], (hi - lo) * sizeof(word32));
+   return nb;
+}  /* end rs_pass() */
+
+
+/* MSD radix sort of idx[lo..hi-1] starting at key byte depth.
+ * Uses tmp[lo..hi-1] only, so disjoint ranges may be sorted at once.
+ * Returns VEOK, or VERROR if out of memory.
+ */
+static int rs_msd(RSORT *rs, word32 *idx, word32 *tmp, word32 lo, word32 hi,
+                  size_t depth)
+{
+   RSSEG *stack, *sp;
+   word32 count[257], n;
+   size_t d;
+   int b, top, max;
+
+   max = 1024;
+   stack = malloc(max * sizeof(RSSEG));
+   if(stack == NULL) return VERROR;
+   stack[0].lo = lo;
+   stack[0].hi = hi;
+   stack[0].depth = depth;
+   top = 1;
+
+   while(top) {
+      sp = &stack[--top];
+      lo = sp->lo;  hi = sp->hi;  d = sp->depth;
+      if(d >= rs->keylen) continue;
+      if(hi - lo < RSSMALL) {
+         rs_insert(rs, idx, lo, hi, d);
+         continue;
+      }
+      if(rs_pass(rs, idx, tmp, lo, hi, d, count) < 2) {
+         /* one bucket: skip the whole common prefix */
+         d = rs_common(rs, idx, lo, hi, d + 1);
+         if(d >= rs->keylen) continue;  /* all keys equal */
+         stack[top].lo = lo;  stack[top].hi = hi;  stack[top].depth = d;
+         top++;
+         continue;
+      }
+      if(top + 256 > max) {
+         max *= 2;
+         sp = realloc(stack, max * sizeof(RSSEG));
+         if(sp == NULL) { free(stack); return VERROR; }
+         stack = sp;
+      }
+      for(b = 0; b < 256; b++) {
+         n = count[b + 1] - count[b];
+         if(n < 2) continue;
+         stack[top].lo = lo + count[b];
+         stack[top].hi = lo + count[b + 1];
+         stack[top].depth = d + 1;
+         top++;
+      }
+   }  /* end while */
+   free(stack);
+   return VEOK;
+}  /* end rs_msd() */
+
+
+/* LSD radix sort of idx[0..n-1]: one pass per key byte. */
+static void rs_lsd(RSORT *rs, word32 *idx, word32 *tmp, word32 n)
+{
+   word32 count[257], j, *src, *dst, *t;
+   size_t d;
+   int b;
+
+   src = idx;
+   dst = tmp;
+   for(d = rs->keylen; d-- > 0; ) {
+      memset(count, 0, sizeof(count));
+      for(j = 0; j < n; j++)
+         count[RSKEY(rs, src[j])[d] + 1]++;
+      if(count[RSKEY(rs, src[0])[d] + 1] == n) continue;  /* all same */
+      for(b = 0; b < 256; b++) count[b + 1] += count[b];
+      for(j = 0; j < n; j++)
+         dst[count[RSKEY(rs, src[j])[d]]++] = src[j];
+      t = src;  src = dst;  dst = t;
+   }
+   if(src != idx) memcpy(idx, src, n * sizeof(word32));
+}  /* end rs_lsd() */
+
+
+/* Thread team member: claim top-level buckets until none remain. */
+static void *rs_worker(void *arg)
+{
+   RSTEAM *team = arg;
+   int b;
+
+   for( ;; ) {
+      pthread_mutex_lock(&team->mutex);
+      b = team->next++;
+      pthread_mutex_unlock(&team->mutex);
+      if(b >= 256) break;
+      if(team->bucket[b + 1] - team->bucket[b] < 2) continue;
+      if(rs_msd(team->rs, team->idx, team->tmp, team->bucket[b],
+                team->bucket[b + 1], 1) != VEOK) team->ecode = VERROR;
+   }
+   return NULL;
+}  /* end rs_worker() */
+
+
+/* Sort top-level buckets of a first-pass distribution with nt threads.
+ * Falls back to sorting in the calling thread if threads fail.
+ */
+static int rs_team(RSORT *rs, word32 *idx, word32 *tmp, word32 *count, int nt)
+{
+   pthread_t tid[RSMAXTHREADS];
+   RSTEAM team;
+   int j, started;
+
+   team.rs = rs;
+   team.idx = idx;
+   team.tmp = tmp;
+   team.bucket = count;
+   team.next = 0;
+   team.ecode = VEOK;
+   pthread_mutex_init(&team.mutex, NULL);
+
+   for(started = 0; started < nt; started++)
+      if(pthread_create(&tid[started], NULL, rs_worker, &team) != 0) break;
+   rs_worker(&team);  /* help out */
+   for(j = 0; j < started; j++)
+      pthread_join(tid[j], NULL);
+   pthread_mutex_destroy(&team.mutex);
+   return team.ecode;
+}  /* end rs_team() */
+
+
+/* Sort the index idx[0..n-1] of records described by rs.
+ * Returns VEOK on success, else VERROR (no memory).
+ */
+int rsort(word32 *idx, word32 n, RSORT *rs)
+{
+   word32 *tmp, count[257];
+   int nt, ecode;
+
+   if(n < 2 || rs->keylen == 0) return VEOK;
+   tmp = malloc(n * sizeof(word32));
+   if(tmp == NULL) return VERROR;
+
+   ecode = VEOK;
+   if(rs->mode == RS_LSD || (rs->mode == RS_AUTO && rs->keylen <= RSLSDMAX)) {
+      rs_lsd(rs, idx, tmp, n);
+      goto out;
+   }
+   nt = Rsort_threads;
+   if(nt == 0) nt = (int) sysconf(_SC_NPROCESSORS_ONLN);
+   if(nt > RSMAXTHREADS) nt = RSMAXTHREADS;
+   if(nt < 2 || n < RSPARMIN) {
+      ecode = rs_msd(rs, idx, tmp, 0, n, 0);
+      goto out;
+   }
+   /* first pass here, then the team takes the 256 buckets */
+   if(rs_pass(rs, idx, tmp, 0, n, 0, count) < 2)
+      ecode = rs_msd(rs, idx, tmp, 0, n, 1);
+   else
+      ecode = rs_team(rs, idx, tmp, count, nt - 1);
+out:
+   free(tmp);
+   return ecode;
+}  /* end rsort() */
+
+
+/* Move the records of rs->base[] into the order given by a sorted
+ * index idx[0..n-1], in place.  idx[] is left as 0,1,2,...,n-1.
+ * Needs the default key locator.  Returns VEOK, or VERROR if no memory.
+ */
+int rs_permute(RSORT *rs, word32 *idx, word32 n)
+{
+   byte *temp;
+   word32 j, k, next;
+   size_t len;
+
+   len = rs->reclen;
+   temp = malloc(len);
+   if(temp == NULL) return VERROR;
+
+   for(j = 0; j < n; j++) {
+      if(idx[j] == j) continue;
+      /* follow the cycle that starts at j */
+      memcpy(temp, rs->base + j * len, len);
+      for(k = j; (next = idx[k]) != j; k = next) {
+         memcpy(rs->base + k * len, rs->base + next * len, len);
+         idx[k] = k;
+      }
+      memcpy(rs->base + k * len, temp, len);
+      idx[k] = k;
+   }
+   free(temp);
+   return VEOK;
+}  /* end rs_permute() */
+
+
+#ifdef TESTRSORT
+
+byte *Keys;
+size_t Reclen, Keylen;
+
+#define SHELLFUN \
+   (memcmp(&Keys[a[k - *gap] * Reclen], &Keys[temp * Reclen], Keylen) > 0)
+#include "sort.c"
+
+word32 Lseed = 1;
+
+word32 rand32(void)
+{
+   Lseed = Lseed * 69069L + 262145L;
+   return Lseed;
+}
+
+double elapsed(struct timespec *t0)
+{
+   struct timespec t1;
+
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* Time shell() and rsort() on n random keys of keylen bytes in
+ * reclen-byte records.  Ledger transaction keys share their first
+ * 2048 bytes in pairs, like an address with a '+' and a '-' entry.
+ */
+void bench(word32 n, size_t reclen, size_t keylen, char *name)
+{
+   RSORT rs;
+   word32 *a, *b, j;
+   size_t i;
+   struct timespec t0;
+   double ts, tr;
+
+   Reclen = reclen;
+   Keylen = keylen;
+   Keys = malloc(n * reclen);
+   a = malloc(n * sizeof(word32));
+   b = malloc(n * sizeof(word32));
+   if(Keys == NULL || a == NULL || b == NULL) {
+      printf("%-8s %8lu  no memory\n", name, (unsigned long) n);
+      goto out;
+   }
+   for(i = 0; i < n * reclen; i++)
+      Keys[i] = rand32() >> 24;
+   if(keylen > 32) {
+      for(j = 1; j < n; j += 2)
+         memcpy(&Keys[j * reclen], &Keys[(j - 1) * reclen], 2048);
+   }
+   for(j = 0; j < n; j++) a[j] = b[j] = j;
+
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   shell(a, n);
+   ts = elapsed(&t0);
+
+   memset(&rs, 0, sizeof(rs));
+   rs.base = Keys;
+   rs.reclen = reclen;
+   rs.keylen = keylen;
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   if(rsort(b, n, &rs) != VEOK) printf("rsort(): no memory\n");
+   tr = elapsed(&t0);
+
+   for(j = 1; j < n; j++) {
+      if(memcmp(&Keys[b[j-1] * reclen], &Keys[b[j] * reclen], keylen) > 0) {
+         printf("rsort(): order error at %lu\n", (unsigned long) j);
+         break;
+      }
+   }
+   printf("%-8s %8lu  shell %10.4f s  rsort %10.4f s  x%.1f\n",
+          name, (unsigned long) n, ts, tr, tr > 0 ? ts / tr : 0.0);
+out:
+   if(Keys) free(Keys);
+   if(a) free(a);
+   if(b) free(b);
+}
+
+int main(int argc, char **argv)
+{
+   static word32 size[] = { 1000, 32768, 1000000 };
+   word32 max;
+   int j;
+
+   max = 1000000;
+   if(argc > 1) max = atol(argv[1]);
+   if(argc > 2) Rsort_threads = atoi(argv[2]);  /* default 1 */
+   printf("usage: rsort [max_records [threads]]  threads: %d\n\n",
+          Rsort_threads);
+   for(j = 0; j < 3 && size[j] <= max; j++)
+      bench(size[j], 32, 32, "tx_id");
+   for(j = 0; j < 3 && size[j] <= max; j++)
+      bench(size[j], 2217, 2209, "LTRAN");
+   return 0;
+}
+
+#endif  /* TESTRSORT */
@@ -9,6 +9,40 @@
 */
 
 
+/* Finish a request read by ev_wait(): status is from gettx().
+ * If she needs execute(), pool_submit() hands node to a worker
+ * thread in pool.c.  Otherwise server() closes the socket.
+ */
+void serve(NODE *node, int status)
+{
+   if(status == sizeof(TX)) {
+      if(pool_submit(node) == VEOK) return;  /* worker has the socket */
+      if(node->opcode == OP_FOUND) Blockfound = 0;  /* missed it */
+   }
+   if(node->sd != INVALID_SOCKET)
+      closesocket(node->sd);
+}  /* end serve() */
+
+
+/* Milliseconds server() may sleep in ev_wait(): zero if a timer
+ * below is due and would do something, else EVTICK or -sN usec.
+ */
+int nexttimer(time_t bctime, time_t mqtime, time_t mwtime)
+{
+   Ltime = time(NULL);
+   if(Ltime >= Stime) return 0;
+   if(Ltime >= bctime && Bcpid == 0 && Blockfound == 0
+      && (Txcount > 0 || (Mpid == 0 && existsnz("txclean.dat"))))
+         return 0;
+   if(Ltime >= mqtime && Mqhead != Mqtail && Mqbusy == 0) return 0;
+   if(mirror_done() || (Sendfound && Founddone)) return 0;
+   if(Ltime >= mwtime && Mpid) return 0;
+   if(Contend_ip && (Ltime - Contend_time) >= LULL) return 0;
+   if(Dynasleep) return (Dynasleep + 999) / 1000;
+   return EVTICK;
+}
+
+
 /**
  * The Mochimo Server/Client!
  *
@@ -16,12 +50,12 @@
  */
 int server(void)
 {
-   static time_t nsd_time;  /* event timers */
-   static time_t bctime, mwtime, mqtime;
-   static SOCKET lsd, nsd;
-   static NODE *np, node;
+   static time_t bctime, mwtime, mqtime;  /* event timers */
+   static SOCKET lsd;
+   static JOB *jp;
+   static NODE *np;
    static struct sockaddr_in addr;
-   static int status;   /* child return status */
+   static int status;   /* child or execute() return status */
    static pid_t pid;    /* child pid */
    static int lfd;      /* for lock() */
    static word32 hps;
@@ -53,7 +87,10 @@ int server(void)
    if(nonblock(lsd) == -1)
       fatal("nonblock() failed on lsd.");
    listen(lsd, LQLEN);  /* LQSIZ */
-   nsd = INVALID_SOCKET;
+   if(ev_open(lsd) != VEOK)
+      fatal("Cannot start event loop.");
+   if(pool_start() != VEOK)
+      fatal("Cannot start worker threads.");
 
    if(Safemode && !iszero(Cblocknum, 8)) {
       plog("Safemode");
@@ -73,87 +110,38 @@ int server(void)
 
       show("listen");  /* display status for ps */
 
-      /* Reap zombies and collect status.
-       * No child left behind...
+      /* Collect requests the workers have finished.
+       * execute() returns 0-3 as her child's exit status was.
        */
-      for(np = Nodes; np < Hi_node; np++) {
-         if(np->pid == 0) continue;
-         pid = waitpid(np->pid, &status, WNOHANG);
-         if(pid <= 0) continue;  /* child still running or signal */
-         freeslot(np);
-         if(Trace) plog("np->pid: %d  pid: %d  status: 0x%x  op: %d  (%d)",
-                        np->pid, pid, status, np->opcode, errno);  /* debug */
-         /* Adds to lists if needed and returns exit status 0-3 */
-         status = child_status(np, pid, status);
+      while((jp = pool_done()) != NULL) {
+         np = &jp->node;
+         status = jp->status;
+         if(Trace) plog("job done: status: %d  op: %d", status, np->opcode);
+         if(status >= 2) pinklist(np->src_ip);
+         if(status >= 3) epinklist(np->src_ip);
          if(np->opcode == OP_FOUND) {
             if(Blockfound == 0) error("server(): line %d", __LINE__);
             else {
                if(update("rblock.dat", 0) == VEOK)
-                  send_found();  /* start send_found() child */
+                  send_found();  /* start send_found() thread */
                Blockfound = 0;
             }
          }  /* end if OP_FOUND child */
-         else if(np->opcode == OP_GETBLOCK || np->opcode == OP_GET_TFILE) {
+         else if(np->opcode == OP_GETBLOCK || np->opcode == OP_GET_TFILE
+                 || np->opcode == OP_GET_TRAILERS) {
             if(status == 0) addrecent(np->src_ip);
          }
-      }  /* end for check Node[] zombies */
+         free(jp);
+      }  /* end while pool_done() */
 
-      /* Reap a send_found() child.  If she is done, pid != 0. */
-      if(Sendfound_pid > 0) {
-         pid = waitpid(Sendfound_pid, &status, WNOHANG);
-         if(pid > 0) Sendfound_pid = 0;
-      }
+      /* Join a send_found() thread that is done. */
+      if(Sendfound && Founddone) found_stop();
 
-      /* Check for new connection with accept() and set nsd. */
-      if(nsd == INVALID_SOCKET) {
-         if((nsd = accept(lsd, NULL, NULL)) != INVALID_SOCKET) {
-            nonblock(nsd);
-            nsd_time = Ltime;
-         }
-      }
-
-      /*
-       * If accept() good,
-       * try to read data from socket, nsd, using gettx().
+      /* Drop connections that are slow with OP_HELLO or the request,
+       * and our own streams that are idle.
        */
-      if(nsd != INVALID_SOCKET) {
-         /* gettx() completes the initial handshake and fills node
-          * and some parent tables.  It returns -1 if no data yet.
-          * If gettx() completes the transaction, it returns 0, 1, 2, or 3;
-          * otherwise it returns sizeof(TX) and needs help from child
-          * so getslot() allocates a new np and copies node into it.
-          */
-         status = gettx(&node, nsd);  /* fills in node */
-         if(status != -1) {
-            if(status == sizeof(TX) && (np = getslot(&node)) != NULL) {
-               pid = fork();  /* create child to handle TX */
-               if(pid == 0) {
-                  /* in child */
-                  exit(execute(np));  /* parent calls waitpid() for status */
-               }
-               /* parent puts valid child pid in parent table */
-               if(pid != -1) np->pid = pid;
-               else {
-                  /* fork() failed so freeslot() removes child data from 
-                   * parent Node[] table.
-                   */
-                  freeslot(np);
-                  error("fork() failed!");
-                  restart("cannot fork()");
-               }
-            }  /* end if need child and slot found */
-            /* parent closes its socket if gettx() did not */
-            if(node.sd != INVALID_SOCKET)
-               closesocket(nsd);
-            nsd = INVALID_SOCKET;
-         } else {   /* status == -1 no data yet -- so check timeout */
-            if(Ltime - nsd_time > INIT_TIMEOUT) {
-               Ntimeouts++;  /* log statistics */
-               closesocket(nsd);
-               nsd = INVALID_SOCKET;
-            }
-         }  /* end if timeout */
-      }  /* endif nsd valid */
+      ev_expire();
+      sess_expire();
 
       Ngen++;  /* loop counter */
 
@@ -170,7 +158,7 @@ int server(void)
          if(cmp64(Cblocknum, Bcbnum) == 0) {
             /* We solved a block! */
             if(update("mblock.dat", 1) == VEOK)
-               send_found();  /* start send_found() child */
+               send_found();  /* start send_found() thread */
          }
          unlink("mblock.dat");
          Blockfound = 0;
@@ -229,23 +217,11 @@ skipbc:
       }
 
       /* Start mirror()? */
-      if(Ltime >= mqtime && Mqcount > 0 && Mqpid == 0) {
-         /* get exclusive access to txq1.dat */
-         lfd = lock("mq.lck", 10);
-         if(lfd != -1) {
-            unlink("mirror.dat");
-            rename("mq.dat", "mirror.dat");
-            Mqcount = 0;
-            unlock(lfd);
-            Mqpid = mirror();  /* start child */
-         }
-      }
-      if(Mqpid) {
-         pid = waitpid(Mqpid, NULL, WNOHANG);
-         if(pid > 0) {
-            Mqpid = 0;
-            mqtime = Ltime + 2;
-         }
+      if(Ltime >= mqtime && Mqhead != Mqtail && Mqbusy == 0)
+         mirror();  /* start threads */
+      if(mirror_done()) {
+         stop_mirror();
+         mqtime = Ltime + 2;
       }
 
       /*
@@ -263,13 +239,20 @@ skipbc:
       if(Monitor && !Bgflag)
          monitor();
 
-      /* dynamic sleep function */
-      if(Dynasleep != 0 && Nonline < 1) usleep(Dynasleep);
+      /* Sleep until a connection or packet arrives, a child exits,
+       * or a timer is due.  Requests are read and served in here.
+       */
+      ev_wait(nexttimer(bctime, mqtime, mwtime));
 
    } /* end while(Running) */
    /*
     * Clean up server and exit
     */
+   pool_stop();       /* drop queued requests */
+   stop_mirror();
+   found_stop();
+   sess_close();      /* close our streams to peers */
+   ev_close();        /* close half-open connections */
    closesocket(lsd);  /* close listening socket */
    return 0;          /* main() will finish cleanup */
 } /* end server() */
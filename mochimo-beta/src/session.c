@@ -0,0 +1,195 @@
+/* session.c  Long-lived connections to peers
+ *
+ * Copyright (c) 2018 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.TXT   **** NO WARRANTY ****
+ *
+ * The Mochimo Project System Software
+ *
+ * Date: 19 October 2026
+ *
+ * mirror(), send_found(), and get_ipl() talk to peers through
+ * Sess[].  A session is one callserver() to a peer.  If the peer
+ * has C_STREAM in her OP_HELLO_ACK, she reads request after request
+ * on it, so the socket is kept for the next caller until it has
+ * been idle SESSIDLE seconds.  Otherwise it is closed after each
+ * use, as before.
+ *
+ * A peer that will not connect or answer is not called again for
+ * 1, 2, 4, ... up to SESSMAXWAIT seconds.
+ *
+ * sess_get() and sess_put() are called from any thread.  One caller
+ * at a time has a session; others wait for her.
+*/
+
+#include <pthread.h>
+
+#define SESSIDLE     30    /* close unused stream after (seconds)  */
+#define SESSMAXWAIT  300   /* longest backoff after failures       */
+
+typedef struct {
+   NODE node;        /* sd is INVALID_SOCKET when not connected */
+   word32 ip;        /* zero if slot is free */
+   time_t idle;      /* close stream after this time */
+   time_t retry;     /* no new connect before this time */
+   int fails;        /* in a row */
+   byte busy;        /* a caller has it */
+} SESSION;
+
+SESSION Sess[SESSLEN];
+pthread_mutex_t Sessmutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Sesscond = PTHREAD_COND_INITIALIZER;
+
+
+/* Close sp's socket.  Caller has sp busy or holds Sessmutex. */
+void sess_hangup(SESSION *sp)
+{
+   if(sp->node.sd != INVALID_SOCKET) closesocket(sp->node.sd);
+   sp->node.sd = INVALID_SOCKET;
+}
+
+
+/* Find the session for ip, or make one.  Caller holds Sessmutex.
+ * Returns NULL if Sess[] is full of busy sessions.
+ */
+SESSION *sess_find(word32 ip)
+{
+   SESSION *sp, *lru;
+
+   lru = NULL;
+   for(sp = Sess; sp < &Sess[SESSLEN]; sp++) {
+      if(sp->ip == ip) return sp;
+      if(sp->busy) continue;
+      /* an empty slot, else the least recently used */
+      if(lru == NULL) lru = sp;
+      else if(lru->ip != 0 && (sp->ip == 0 || sp->idle < lru->idle))
+         lru = sp;
+   }
+   if(lru == NULL) return NULL;
+   if(lru->ip) sess_hangup(lru);
+   memset(lru, 0, sizeof(SESSION));
+   lru->node.sd = INVALID_SOCKET;
+   lru->ip = ip;
+   return lru;
+}  /* end sess_find() */
+
+
+/* Return non-zero if the stream on sp is still open. */
+int sess_alive(SESSION *sp)
+{
+   char c;
+   int count;
+
+   count = recv(sp->node.sd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+   if(count < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) return 1;
+   return 0;  /* closed, or she sent what we did not ask for */
+}
+
+
+/* Get a connected NODE for ip, waiting if another thread has it.
+ * Caller sends on it and gives it back with sess_put().
+ * Returns NULL if ip is backing off or will not connect.
+ */
+NODE *sess_get(word32 ip)
+{
+   return sess_get2(ip, 0);
+}
+
+
+/* sess_get() that gives up after seconds, if not zero, to get
+ * the session and have the peer answer.
+ */
+NODE *sess_get2(word32 ip, int seconds)
+{
+   SESSION *sp;
+   struct timespec ts;
+   time_t deadline;
+
+   deadline = seconds ? time(NULL) + seconds : 0;
+   pthread_mutex_lock(&Sessmutex);
+   for( ;; ) {
+      sp = sess_find(ip);
+      if(sp != NULL && !sp->busy) break;
+      if(!Running || (deadline && time(NULL) >= deadline)) {
+         sp = NULL;
+         break;
+      }
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec++;  /* look at Running again */
+      pthread_cond_timedwait(&Sesscond, &Sessmutex, &ts);
+   }
+   if(sp == NULL || (sp->node.sd == INVALID_SOCKET
+                     && time(NULL) < sp->retry)) {
+      pthread_mutex_unlock(&Sessmutex);
+      return NULL;
+   }
+   sp->busy = 1;
+   pthread_mutex_unlock(&Sessmutex);
+
+   if(sp->node.sd != INVALID_SOCKET && !sess_alive(sp)) sess_hangup(sp);
+   if(sp->node.sd == INVALID_SOCKET) {
+      if(deadline) seconds = deadline - time(NULL);
+      else seconds = ACK_TIMEOUT;
+      if(seconds < 1) seconds = 1;
+      if(callserver2(&sp->node, ip, seconds) != VEOK) {
+         sess_put(&sp->node, VERROR);
+         return NULL;
+      }
+      /* keep it out of bcon and friends */
+      fcntl(sp->node.sd, F_SETFD, FD_CLOEXEC);
+   }
+   return &sp->node;
+}  /* end sess_get2() */
+
+
+/* Give back np from sess_get().  status is VEOK if the peer
+ * answered, else the session is closed and backs off.
+ */
+void sess_put(NODE *np, int status)
+{
+   SESSION *sp;
+   int wait;
+
+   sp = (SESSION *) np;  /* node is first */
+   pthread_mutex_lock(&Sessmutex);
+   if(status != VEOK) {
+      sess_hangup(sp);
+      if(sp->fails < 16) sp->fails++;
+      wait = 1 << (sp->fails - 1);
+      if(wait > SESSMAXWAIT) wait = SESSMAXWAIT;
+      sp->retry = time(NULL) + wait;
+   } else {
+      sp->fails = 0;
+      if((sp->node.caps & C_STREAM) == 0) sess_hangup(sp);
+   }
+   sp->idle = time(NULL) + SESSIDLE;
+   sp->busy = 0;
+   pthread_cond_broadcast(&Sesscond);
+   pthread_mutex_unlock(&Sessmutex);
+}  /* end sess_put() */
+
+
+/* Close streams that have been idle.  Called by server(). */
+void sess_expire(void)
+{
+   SESSION *sp;
+
+   pthread_mutex_lock(&Sessmutex);
+   for(sp = Sess; sp < &Sess[SESSLEN]; sp++) {
+      if(sp->busy || sp->ip == 0 || sp->node.sd == INVALID_SOCKET)
+         continue;
+      if(Ltime > sp->idle) sess_hangup(sp);
+   }
+   pthread_mutex_unlock(&Sessmutex);
+}
+
+
+/* Close all sessions that are not in use. */
+void sess_close(void)
+{
+   SESSION *sp;
+
+   pthread_mutex_lock(&Sessmutex);
+   for(sp = Sess; sp < &Sess[SESSLEN]; sp++)
+      if(!sp->busy && sp->ip) sess_hangup(sp);
+   pthread_mutex_unlock(&Sessmutex);
+}
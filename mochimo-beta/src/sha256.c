@@ -115,27 +115,56 @@ void sha256_init(SHA256_CTX *ctx)
 }
 
 
-/* data[] is less than 64k bytes in length on 16-bit machines. */
-void sha256_update(SHA256_CTX *ctx, const byte data[], unsigned len)
-{
-   unsigned i;
-   word32 old;
-
-	for(i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if(ctx->datalen == 64) {
-			sha256_transform(ctx, ctx->data);
+/* Count one more 512-bit block in the message length. */
 #ifdef LONG64
-			ctx->bitlen += 512;
+#define ADD512(ctx)  ((ctx)->bitlen += 512)
 #else
-            old = ctx->bitlen;
-            ctx->bitlen += 512;
-            if(ctx->bitlen < old) ctx->bitlen2++;  /* add in carry */
+#define ADD512(ctx) \
+   { if((ctx)->bitlen + 512 < (ctx)->bitlen) (ctx)->bitlen2++; \
+     (ctx)->bitlen += 512; }
 #endif
-			ctx->datalen = 0;
-		}
-	}
+
+
+/* data[] is less than 64k bytes in length on 16-bit machines.
+ * Whole blocks are transformed straight from data[]; only
+ * partial blocks are copied to ctx->data[].
+ */
+void sha256_update(SHA256_CTX *ctx, const byte data[], unsigned len)
+{
+   unsigned n;
+
+   for( ; len; data += n, len -= n) {
+      if(ctx->datalen == 0 && len >= 64) {
+         sha256_transform(ctx, data);
+         n = 64;
+      } else {
+         n = 64 - ctx->datalen;
+         if(n > len) n = len;
+         memcpy(&ctx->data[ctx->datalen], data, n);
+         ctx->datalen += n;
+         if(ctx->datalen < 64) break;
+         sha256_transform(ctx, ctx->data);
+         ctx->datalen = 0;
+      }
+      ADD512(ctx);
+   }
+}
+
+
+/* Update two contexts with the same data[] in one pass:
+ * each 64-byte stretch is hashed into both while it is in cache.
+ * For a block hash and a Merkel array hash over the same TX's.
+ */
+void sha256_update2(SHA256_CTX *ctx, SHA256_CTX *ctx2, const byte data[],
+                    unsigned len)
+{
+   unsigned n;
+
+   for( ; len; data += n, len -= n) {
+      n = len < 64 ? len : 64;
+      sha256_update(ctx, data, n);
+      sha256_update(ctx2, data, n);
+   }
 }
 
 
@@ -210,3 +239,94 @@ void sha256(const byte *in, int inlen, byte *hashout)
    sha256_update(&ctx, in, inlen);
    sha256_final(&ctx, hashout);
 }
+
+
+/* Hash SHA256_LANES messages of inlen bytes each, message i at
+ * in + i * stride, to hashout + i * 32.  All lanes go through each
+ * round together: with GCC the LANE vector type puts them in SIMD
+ * registers; elsewhere the lanes are hashed one by one.
+ */
+#ifdef __GNUC__
+
+typedef word32 LANE __attribute__ ((vector_size (4 * SHA256_LANES)));
+
+void sha256x8(const byte *in, unsigned stride, unsigned inlen,
+              byte *hashout)
+{
+   static const word32 h0[8] = {
+      0x6a09e667L, 0xbb67ae85L, 0x3c6ef372L, 0xa54ff53aL,
+      0x510e527fL, 0x9b05688cL, 0x1f83d9abL, 0x5be0cd19L
+   };
+   LANE a, b, c, d, e, f, g, h, t1, t2, m[64], state[8];
+   byte block[64];
+   const byte *bp;
+   unsigned long bitlen;
+   unsigned pos, n, nblocks, blk;
+   int i, j, lane;
+
+   for(i = 0; i < 8; i++)
+      for(lane = 0; lane < SHA256_LANES; lane++) state[i][lane] = h0[i];
+   nblocks = (inlen + 9 + 63) / 64;  /* with 0x80 and the bit length */
+   bitlen = (unsigned long) inlen * 8;
+   for(blk = 0, pos = 0; blk < nblocks; blk++, pos += 64) {
+      /* Load this block of every lane, padded as in sha256_final(). */
+      for(lane = 0; lane < SHA256_LANES; lane++) {
+         if(pos + 64 <= inlen) bp = in + lane * stride + pos;
+         else {
+            memset(block, 0, 64);
+            n = pos < inlen ? inlen - pos : 0;
+            memcpy(block, in + lane * stride + pos, n);
+            if(pos <= inlen) block[n] = 0x80;
+            if(blk == nblocks - 1) {
+               for(i = 0; i < 8; i++)
+                  block[63 - i] = (byte) (bitlen >> (i * 8));
+            }
+            bp = block;
+         }
+         for(i = j = 0; i < 16; ++i, j += 4)
+            m[i][lane] = ((word32) bp[j] << 24) | ((word32) bp[j + 1] << 16)
+                         | ((word32) bp[j + 2] << 8) | ((word32) bp[j + 3]);
+      }
+      for(i = 16; i < 64; ++i)
+         m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
+
+      a = state[0];  b = state[1];  c = state[2];  d = state[3];
+      e = state[4];  f = state[5];  g = state[6];  h = state[7];
+      for(i = 0; i < 64; ++i) {
+         t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
+         t2 = EP0(a) + MAJ(a,b,c);
+         h = g;
+         g = f;
+         f = e;
+         e = d + t1;
+         d = c;
+         c = b;
+         b = a;
+         a = t1 + t2;
+      }
+      state[0] += a;  state[1] += b;  state[2] += c;  state[3] += d;
+      state[4] += e;  state[5] += f;  state[6] += g;  state[7] += h;
+   }  /* end for blk */
+
+   for(lane = 0; lane < SHA256_LANES; lane++, hashout += 32) {
+      for(i = 0; i < 8; i++) {
+         hashout[i * 4]     = (byte) (state[i][lane] >> 24);
+         hashout[i * 4 + 1] = (byte) (state[i][lane] >> 16);
+         hashout[i * 4 + 2] = (byte) (state[i][lane] >> 8);
+         hashout[i * 4 + 3] = (byte) state[i][lane];
+      }
+   }
+}  /* end sha256x8() */
+
+#else
+
+void sha256x8(const byte *in, unsigned stride, unsigned inlen,
+              byte *hashout)
+{
+   int lane;
+
+   for(lane = 0; lane < SHA256_LANES; lane++, in += stride, hashout += 32)
+      sha256(in, inlen, hashout);
+}
+
+#endif  /* __GNUC__ */
@@ -39,11 +39,16 @@ typedef struct {
 } SHA256_CTX;
 
 #define SHA256_BLOCK_SIZE 32     /* SHA256 outputs a byte hash[32] digest */
+#define SHA256_LANES 8           /* messages hashed at once by sha256x8() */
 
 /* Prototypes */
 void sha256_init(SHA256_CTX *ctx);
 void sha256_update(SHA256_CTX *ctx, const byte data[], unsigned len);
+void sha256_update2(SHA256_CTX *ctx, SHA256_CTX *ctx2, const byte data[],
+                    unsigned len);
 void sha256_final(SHA256_CTX *ctx, byte hash[]);  /* hash is 32 bytes */
 void sha256(const byte *in, int inlen, byte *hashout);
+void sha256x8(const byte *in, unsigned stride, unsigned inlen,
+              byte *hashout);
 
 #endif   /* SHA256_H */
@@ -42,6 +42,135 @@ int blocking(SOCKET sd)
    return fcntl(sd, F_SETFL, flags & (~O_NONBLOCK));
 }
 
+#include <poll.h>
+
+/* Milliseconds on the monotonic clock, for deadlines that
+ * do not jump when the wall clock is set.
+ */
+long long mstime(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* Sleep in poll() until sd is ready for events (POLLIN or POLLOUT)
+ * or mstime() reaches deadline.
+ * Returns VEOK when ready, else VETIMEOUT.
+ */
+int sock_wait(SOCKET sd, int events, long long deadline)
+{
+   struct pollfd pfd;
+   long long ms;
+   int n;
+
+   for(;;) {
+      ms = deadline - mstime();
+      if(ms <= 0) return VETIMEOUT;
+      pfd.fd = sd;
+      pfd.events = events;
+      pfd.revents = 0;
+      n = poll(&pfd, 1, (int) ms);
+      if(n > 0) return VEOK;  /* ready, or error for recv() to see */
+      if(n < 0 && errno != EINTR) return VETIMEOUT;
+   }
+}  /* end sock_wait() */
+
+
+/* Receive exactly len bytes from non-blocking sd into buff
+ * within seconds.
+ * Returns VEOK, VERROR if the peer closed or failed, or VETIMEOUT.
+ */
+int recvall(SOCKET sd, void *buff, int len, int seconds)
+{
+   long long deadline;
+   int n, count;
+
+   deadline = mstime() + seconds * 1000LL;
+   for(n = 0; n < len; ) {
+      count = recv(sd, (byte *) buff + n, len - n, 0);
+      if(count == 0) return VERROR;
+      if(count < 0) {
+         if(errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)
+            return VERROR;
+         if(sock_wait(sd, POLLIN, deadline) != VEOK) return VETIMEOUT;
+         continue;
+      }
+      n += count;
+   }
+   return VEOK;
+}  /* end recvall() */
+
+
+/* Send exactly len bytes from buff on non-blocking sd within seconds.
+ * Returns VEOK, VERROR if the peer failed, or VETIMEOUT.
+ */
+int sendall(SOCKET sd, void *buff, int len, int seconds)
+{
+   long long deadline;
+   int n, count;
+
+   deadline = mstime() + seconds * 1000LL;
+   for(n = 0; n < len; ) {
+      count = send(sd, (byte *) buff + n, len - n, 0);
+      if(count == 0) return VERROR;
+      if(count < 0) {
+         if(errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)
+            return VERROR;
+         if(sock_wait(sd, POLLOUT, deadline) != VEOK) return VETIMEOUT;
+         continue;
+      }
+      n += count;
+   }
+   return VEOK;
+}  /* end sendall() */
+
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+/* Send the first len bytes of file fd on non-blocking sd.  With
+ * sendfile() the data go from the page cache to the socket without
+ * a copy through user space.  Fails if no byte moves for seconds.
+ * Returns VEOK, VERROR, or VETIMEOUT.
+ */
+int sendfd(SOCKET sd, int fd, size_t len, int seconds)
+{
+   off_t off;
+   ssize_t count;
+#ifdef __linux__
+   long long deadline;
+
+   deadline = mstime() + seconds * 1000LL;
+   for(off = 0; (size_t) off < len; ) {
+      count = sendfile(sd, fd, &off, len - off);
+      if(count == 0) return VERROR;  /* file is short */
+      if(count < 0) {
+         if(errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)
+            return VERROR;
+         if(sock_wait(sd, POLLOUT, deadline) != VEOK) return VETIMEOUT;
+         continue;
+      }
+      deadline = mstime() + seconds * 1000LL;
+   }
+#else
+   byte buff[BULKBUFF];
+   int status;
+
+   for(off = 0; (size_t) off < len; off += count) {
+      count = len - off < BULKBUFF ? len - off : BULKBUFF;
+      count = pread(fd, buff, count, off);
+      if(count <= 0) return VERROR;
+      status = sendall(sd, buff, count, seconds);
+      if(status != VEOK) return status;
+   }
+#endif
+   return VEOK;
+}  /* end sendfd() */
+
 #endif
 
 
@@ -23,6 +23,7 @@ void shell(unsigned *a, int n)
 {
 
    static int gaps[] = {
+      5243697, 2330532, 1035792, 460352, 204601,
       90934, 40415, 17962, 7983, 3548, 1577,
         701,   301,   132,   57,   23,   10, 4, 1
    };  /* k = k * 2.25 */
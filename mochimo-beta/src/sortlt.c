@@ -22,27 +22,19 @@ byte Monitor;
 byte Running = 1;
 word32 Trace = 1;
 word32 Nsolved;
-pid_t Mpid, Sendfound_pid;  /* in error.c */
+pid_t Mpid;  /* in error.c */
 
 #include "error.c"
 #include "daemon.c"
 
-word32 Nlt;     /* number of transactions in ltran.dat */
-word32 *Ltidx;  /* malloc'd Ltidx[] Nlt * 4 bytes */
-LTRAN *Ltrans;  /* malloc'd Ltrans[] Nlt * sizeof(LTRAN) bytes */
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
-/* for sorting unsigned indexes:
- * #define SHELLFUN  (a[k - *gap] > temp)
- */
-
-/* Comparison function to sort index to ledger transactions: LTRAN Ltrans[]:
- * a[] is array of word32 indexes, temp is a word32 index
- * include Ltrans[].trancode[0] in key: (+1)
- */
-#define SHELLFUN \
-  (memcmp(Ltrans[a[k - *gap]].addr, Ltrans[temp].addr, TXADDRLEN+1) > 0)
+#include "rsort.c"
 
-#include "sort.c"
+word32 Nlt;     /* number of transactions in ltran.dat */
+word32 *Ltidx;  /* malloc'd Ltidx[] Nlt * 4 bytes */
 
 
 /* get memory or exit */
@@ -57,64 +49,65 @@ void *tmalloc(size_t len) {
 }
 
 
-/* Creates a malloc'd sort index:
- * word32 Ltidx[Nlt] and the transaction list:
- * LTRAN Ltrans[Nlt]
+/* Sorts the ledger transaction file in place on
+ * addr+trancode: '+' sorts before '-'.
+ * The file is mmap'd, the index Ltidx[Nlt] radix sorted,
+ * and the records permuted into place.
  *
  * Returns VERROR on file errors, else VEOK.
  */
 int sortlt(char *fname)
 {
-   FILE *fp;
-   long offset;
+   static RSORT rs;
+   struct stat st;
+   byte *map;
    unsigned j;
+   int fd;
 
    fix_signals();
    close_extra();
 
-   fp = fopen(fname, "r+b");
-   if(fp == NULL) return error("sortlt(): missing %s", fname);
-   if(fseek(fp, 0, SEEK_END) != 0) {
+   map = MAP_FAILED;
+   fd = open(fname, O_RDWR);
+   if(fd < 0) return error("sortlt(): missing %s", fname);
+   if(fstat(fd, &st) != 0) {
 bad:
-      if(Ltrans) free(Ltrans);
+      if(map != MAP_FAILED) munmap(map, st.st_size);
       if(Ltidx) free(Ltidx);
-      Ltrans = NULL;
       Ltidx = NULL;
-      fclose(fp);
+      close(fd);
       return error("I/O error on %s", fname);
    }
-   offset = ftell(fp);
-   if((offset % sizeof(LTRAN)) != 0) goto bad;  /* check record sizes */
+   /* check record sizes */
+   if((st.st_size % sizeof(LTRAN)) != 0) goto bad;
 
    /* compute number of transactions in file */
-   Nlt = offset / sizeof(LTRAN);
+   Nlt = st.st_size / sizeof(LTRAN);
    if(Nlt == 0) goto out;
 
-   /* seek to first TX record of file */
-   if(fseek(fp, 0, SEEK_SET) != 0) goto bad;
+   map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if(map == MAP_FAILED) goto bad;
 
-   /* Allocate array for sort */
+   /* Allocate and initialise index Ltidx[] = 0,1,2,3,4,5,...  */
    Ltidx = tmalloc(Nlt * 4);  /* (word32 *) */
-   Ltrans = tmalloc(Nlt * sizeof(LTRAN));  /* (LTRAN *) */
-
-   /* Read in transaction file */
-   if(fread(Ltrans, sizeof(LTRAN), Nlt, fp) != Nlt) goto bad;
-      
-   /* and initialise index Ltidx[] = 0,1,2,3,4,5,...  */
    for(j = 0; j < Nlt; j++)
       Ltidx[j] = j;
 
-   /* sort the index */
-   shell(Ltidx, Nlt);
-
-   /* write the file back out in sorted order */
-   if(fseek(fp, 0, SEEK_SET) != 0) goto bad;
-   for(j = 0; j < Nlt; j++) {
-      if(fwrite(&Ltrans[Ltidx[j]], 1, sizeof(LTRAN), fp) != sizeof(LTRAN))
-         goto bad;
-   }
+   /* sort the index: include trancode[0] in key: (+1) */
+   rs.base = map;
+   rs.reclen = sizeof(LTRAN);
+   rs.keyoff = 0;
+   rs.keylen = TXADDRLEN + 1;
+   if(rsort(Ltidx, Nlt, &rs) != VEOK) goto bad;
+
+   /* move the records into sorted order */
+   if(rs_permute(&rs, Ltidx, Nlt) != VEOK) goto bad;
+   if(msync(map, st.st_size, MS_SYNC) != 0) goto bad;
+   munmap(map, st.st_size);
+   free(Ltidx);
+   Ltidx = NULL;
 out:
-   fclose(fp);
+   close(fd);
    return VEOK;
 }  /* end sortlt() */
 
@@ -13,16 +13,7 @@ word32 Ntx;     /* number of transactions in clean TX queue */
 word32 *Txidx;  /* malloc'd Txidx[] Ntx*4 bytes */
 byte *Tx_ids;   /* malloc'd Tx_ids[] Ntx*32 bytes */
 
-/* for sorting unsigned indexes:
- * #define SHELLFUN  (a[k - *gap] > temp)
- */
-
-/* To sort the TX_ID's:
- * a[] is array of word32 indexes, temp is a word32 index
- */
-#define SHELLFUN (memcmp(&Tx_ids[a[k - *gap]*32], &Tx_ids[temp*32], 32) > 0)
-
-#include "sort.c"
+#include "rsort.c"
 
 
 /* Creates a malloc'd sort index:
@@ -37,6 +28,7 @@ int sorttx(char *fname)
    long offset;
    byte *bp;
    unsigned j;
+   static RSORT rs;
 
    fp = fopen(fname, "rb");
    if(fp == NULL) return error("sorttx(): missing %s", fname);
@@ -76,8 +68,11 @@ bad:
       Txidx[j] = j;
    }
 
-   /* sort the index */
-   shell(Txidx, Ntx);
+   /* radix sort the index on the TX_ID's */
+   rs.base = Tx_ids;
+   rs.reclen = HASHLEN;
+   rs.keylen = HASHLEN;
+   if(rsort(Txidx, Ntx, &rs) != VEOK) goto bad;
 out:
    fclose(fp);
    return VEOK;
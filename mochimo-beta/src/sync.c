@@ -0,0 +1,214 @@
+/* sync.c  Parallel block download for get_eon()
+ *
+ * Copyright (c) 2018 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.TXT   **** NO WARRANTY ****
+ *
+ * The Mochimo Project System Software
+ *
+ * Date: 19 October 2026
+ *
+ * sync_start() starts two downloader threads per gang[] member.
+ * They fetch blocks first...last, less neo-genesis blocks, into
+ * SYNCDIR, keeping no more than SYNCWIN blocks ahead of the one
+ * get_eon() is updating.  Block requests are dealt round-robin
+ * across gang[]; a failed block goes to the next member, and fails
+ * for good after SYNCTRIES tries at each member.
+ *
+ * sync_next() waits for the next block in order.  The window
+ * Syncwin[] is a ring of SYNCWIN slots from Sync_head.
+*/
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define SYNCDIR     "sync"
+#define SYNCTRIES   2     /* tries per gang member */
+
+#define SY_WAIT     0     /* slot needs a downloader */
+#define SY_BUSY     1
+#define SY_DONE     2     /* block is in SYNCDIR */
+#define SY_FAIL     3     /* gave up */
+
+typedef struct {
+   byte bnum[8];
+   int state;        /* SY_WAIT, ... */
+   int tries;
+   int peer;         /* gang index to try next */
+   word32 ip;        /* who sent it */
+} SYNCSLOT;
+
+SYNCSLOT Syncwin[SYNCWIN];
+int Sync_head, Sync_count;    /* slots in use from Sync_head */
+word32 Sync_gang[MAXQUORUM];
+int Sync_ngang, Sync_deal;    /* Sync_deal: next gang index to deal */
+byte Sync_bnum[8];            /* next block to put in the window */
+byte Sync_last[8];
+byte Sync_stop;
+int Sync_nthread;
+pthread_t Sync_tid[MAXQUORUM * 2];
+pthread_mutex_t Syncmutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Synccond = PTHREAD_COND_INITIALIZER;
+
+
+/* Put SYNCDIR/bNNN.bc name in fname.  bnum2hex() is not for threads. */
+void syncname(char *fname, byte *bnum)
+{
+   sprintf(fname, "%s/b%02x%02x%02x%02x%02x%02x%02x%02x.bc", SYNCDIR,
+           bnum[7], bnum[6], bnum[5], bnum[4],
+           bnum[3], bnum[2], bnum[1], bnum[0]);
+}
+
+
+/* Claim a slot to download: oldest retry first, else a new block.
+ * Caller holds Syncmutex.  Returns NULL if there is none.
+ */
+SYNCSLOT *sync_claim(void)
+{
+   SYNCSLOT *sp;
+   int j;
+
+   for(j = 0; j < Sync_count; j++) {
+      sp = &Syncwin[(Sync_head + j) % SYNCWIN];
+      if(sp->state == SY_WAIT) return sp;
+   }
+   if(Sync_count >= SYNCWIN || cmp64(Sync_bnum, Sync_last) > 0)
+      return NULL;
+   sp = &Syncwin[(Sync_head + Sync_count++) % SYNCWIN];
+   memset(sp, 0, sizeof(SYNCSLOT));
+   put64(sp->bnum, Sync_bnum);
+   sp->peer = Sync_deal++ % Sync_ngang;
+   add64(Sync_bnum, One, Sync_bnum);
+   if(Sync_bnum[0] == 0)
+      add64(Sync_bnum, One, Sync_bnum);  /* do not fetch NG blocks */
+   return sp;
+}  /* end sync_claim() */
+
+
+void *sync_thread(void *arg)
+{
+   SYNCSLOT *sp;
+   byte bnum[8];
+   word32 ip;
+   char fname[100];
+   int status;
+
+   pthread_mutex_lock(&Syncmutex);
+   while(!Sync_stop && Running) {
+      sp = sync_claim();
+      if(sp == NULL) {
+         pthread_cond_wait(&Synccond, &Syncmutex);
+         continue;
+      }
+      sp->state = SY_BUSY;
+      put64(bnum, sp->bnum);
+      ip = Sync_gang[sp->peer];
+      pthread_mutex_unlock(&Syncmutex);
+
+      syncname(fname, bnum);
+      status = get_block2(ip, bnum, fname, OP_GETBLOCK);
+
+      pthread_mutex_lock(&Syncmutex);
+      if(status == VEOK) {
+         sp->state = SY_DONE;
+         sp->ip = ip;
+      } else {
+         sp->peer = (sp->peer + 1) % Sync_ngang;
+         if(++sp->tries >= SYNCTRIES * Sync_ngang) sp->state = SY_FAIL;
+         else sp->state = SY_WAIT;
+      }
+      pthread_cond_broadcast(&Synccond);
+   }
+   pthread_mutex_unlock(&Syncmutex);
+   return NULL;
+}  /* end sync_thread() */
+
+
+/* Start downloading blocks first...last from the ngang peers
+ * in gang[] into SYNCDIR.
+ * Returns VEOK, or VERROR if no downloader would start.
+ */
+int sync_start(word32 *gang, int ngang, byte *first, byte *last)
+{
+   sigset_t all, old;
+   int j;
+
+   system("rm -rf " SYNCDIR);  /* leftovers */
+   if(mkdir(SYNCDIR, 0777) != 0)
+      return error("sync_start(): cannot make %s", SYNCDIR);
+   if(ngang > MAXQUORUM) ngang = MAXQUORUM;
+   memcpy(Sync_gang, gang, ngang * sizeof(word32));
+   Sync_ngang = ngang;
+   Sync_deal = 0;
+   Sync_head = Sync_count = 0;
+   put64(Sync_bnum, first);
+   put64(Sync_last, last);
+   Sync_stop = 0;
+
+   sigfillset(&all);
+   pthread_sigmask(SIG_BLOCK, &all, &old);  /* signals stay with us */
+   for(j = Sync_nthread = 0; j < ngang * 2; j++) {
+      if(pthread_create(&Sync_tid[Sync_nthread], NULL,
+                        sync_thread, NULL) != 0) break;
+      Sync_nthread++;
+   }
+   pthread_sigmask(SIG_SETMASK, &old, NULL);
+   if(Trace) plog("sync_start(): %d downloaders", Sync_nthread);
+   return Sync_nthread ? VEOK : VERROR;
+}  /* end sync_start() */
+
+
+/* Wait for the block at the head of the window, which must be bnum.
+ * Puts its file name in fname and the peer that sent it in *ip.
+ * Caller unlinks fname when done with it.
+ * Returns VEOK, or VERROR if no peer in gang[] would send it.
+ */
+int sync_next(byte *bnum, char *fname, word32 *ip)
+{
+   SYNCSLOT *sp;
+   struct timespec ts;
+   int status;
+
+   pthread_mutex_lock(&Syncmutex);
+   for(;;) {
+      sp = &Syncwin[Sync_head];
+      if(Sync_count > 0 && cmp64(sp->bnum, bnum) != 0) {
+         status = VERROR;  /* not in window */
+         break;
+      }
+      if(Sync_count > 0
+         && (sp->state == SY_DONE || sp->state == SY_FAIL)) {
+         status = sp->state == SY_DONE ? VEOK : VERROR;
+         *ip = sp->ip;
+         Sync_head = (Sync_head + 1) % SYNCWIN;
+         Sync_count--;
+         pthread_cond_broadcast(&Synccond);  /* window moved */
+         break;
+      }
+      if(!Running) { status = VERROR;  break; }
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec++;  /* look at Running again */
+      pthread_cond_timedwait(&Synccond, &Syncmutex, &ts);
+   }
+   pthread_mutex_unlock(&Syncmutex);
+   syncname(fname, bnum);
+   if(status != VEOK && Trace)
+      plog("sync_next(): cannot get block 0x%s", bnum2hex(bnum));
+   return status;
+}  /* end sync_next() */
+
+
+/* Stop the downloaders and remove SYNCDIR. */
+void sync_stop(void)
+{
+   int j;
+
+   pthread_mutex_lock(&Syncmutex);
+   Sync_stop = 1;
+   pthread_cond_broadcast(&Synccond);
+   pthread_mutex_unlock(&Syncmutex);
+   for(j = 0; j < Sync_nthread; j++)
+      pthread_join(Sync_tid[j], NULL);
+   Sync_nthread = 0;
+   Sync_count = 0;
+   system("rm -rf " SYNCDIR);
+}  /* end sync_stop() */
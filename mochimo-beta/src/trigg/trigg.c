@@ -9,6 +9,8 @@
 
 #include "../sha256.h"
 
+#include "trigg.h"
+
 #include <stdlib.h>
 
 #include <string.h>
@@ -105,7 +107,7 @@ typedef word32 FE;  typedef struct { byte tok[12];  FE fe;
 #define MAXH    16
 
 #include "tdict.c"
-static int Tdiff; static byte Tchain[32+256+16+8];   static
+static TRIGG Trigg;   static
 FE Frame[][MAXH] = {  { F_PREP, F_ADJ, F_MASS, S_NL, F_NPL,
 S_NL, F_INF | F_ING }, { F_PREP, F_MASS, S_NL, F_ADJ, F_NPL,
 S_NL, F_INF | F_ING }, { F_PREP, F_TIMED, S_NL, F_ADJ, F_NPL,
@@ -120,9 +122,12 @@ S_MD, S_NL, S_A, F_ADJ, F_NS },  { S_A, F_NS, S_NL, F_PREP,
 F_TIMED, F_MASS, S_MD, S_NL, F_ADJ }, }; 
 #define NFRAMES (sizeof(Frame) / (MAXH * sizeof(FE)))
 
-#define FRAME() (&Frame[rand2() % NFRAMES][0])
+#define TRAND(s) ((s) ? rand2r(s) : rand2())
+
+#define TRAND16(s) ((s) ? rand2r(s) : rand16())
+
 
-#define TOKEN() (rand2() % MAXDICT)
+#define TOKEN(s, f, j) (Tlist[f][j][TRAND(s) % Tcount[f][j]])
  
 #define NCONC(list, word) *list++ = word
 
@@ -150,42 +155,65 @@ F_TIMED, F_MASS, S_MD, S_NL, F_ADJ }, };
 static char Trigg_check[] = "Trigg!"; 
 #define TRIGG_CHECK Trigg_check;
 void put16(void *buff, word16 val); word32 rand16(void); word32
-rand2(void);  void trigg_solve(byte *link, int diff, byte
-*bnum) {  Tdiff = diff; memset(Tchain+32, 0, (256+16)); 
-memcpy(Tchain, link, 32); memcpy(Tchain+32+256+16, bnum,
-8); put16(link+32, rand16()); put16(link+34, rand16()); 
-put16(Tchain+(32+256), rand16()); put16(Tchain+(32+258),
-rand16()); }   int trigg_eval(byte *h, byte d) { byte *bp,
+rand2(void);  static byte Tlist[NFRAMES][MAXH][MAXDICT]; static int
+Tcount[NFRAMES][MAXH]; static int Tready;  static void trigg_tables(void)
+{ int f, j, w; for(f = 0; f < NFRAMES; f++) for(j = 0; j < MAXH;
+j++) { Tcount[f][j] = 0; if(Frame[f][j] == NIL || MEMQ(F_XLIT,
+Frame[f][j])) continue; for(w = 0; w < MAXDICT; w++) if(CAT(w,
+Frame[f][j])) Tlist[f][j][Tcount[f][j]++] = w; } Tready = T; } 
+ static void trigg_solve1(TRIGG *t, byte *link, int
+diff, byte *bnum, word32 *s) {  if(NOT(Tready)) trigg_tables(); t->diff = diff; memset(t->chain+32,
+0, (256+16));  memcpy(t->chain, link, 32); memcpy(t->chain+32+256+16,
+bnum, 8); put16(link+32, TRAND16(s)); put16(link+34, TRAND16(s)); 
+put16(t->chain+(32+256), TRAND16(s)); put16(t->chain+(32+258),
+TRAND16(s)); }   void trigg_solve2(TRIGG *t, byte *link, int diff,
+byte *bnum) { trigg_solve1(t, link, diff, bnum, t->seed); }   void
+trigg_solve(byte *link, int diff, byte *bnum) { trigg_solve1(&Trigg,
+link, diff, bnum, NULL); }   int trigg_eval(byte *h, byte d) { byte *bp,
 n; n = d >> 3; for(bp = h; n; n--) { if(*bp++ != 0) return
 NIL; } if((d & 7) == 0) return T; if((*bp & (~(0xff >> (d
 & 7)))) != 0) return NIL; return T; }   int trigg_step(byte
 *in, int n) { byte *bp; for(bp = in; n; n--, bp++) { bp[0]++; 
-if(bp[0] != 0) break; } return T; }  char *trigg_expand(byte
-*in, int diff) { int j; byte *bp, *w; DICT *dp; bp = &Tchain[32]; 
-memset(bp, 0, 256); for(j = 0; j < 16; j++, in++) { if(*in
-== NIL) break; w = TPTR(*in); while(*w) *bp++ = *w++; if(bp[-1]
-!= '\n') *bp++ = ' '; } return (char *) &Tchain[32]; }  
-byte *trigg_gen(byte *in) { byte *hp; FE *fp; int j, widx; 
-fp = FRAME(); hp = in; for(j = 0; j < 16; j++, fp++) { 
+if(bp[0] != 0) break; } return T; }  static byte *trigg_text(byte
+*bp, byte *in) { int j; byte *w, *cp; cp = bp; memset(bp, 0, 256);
+for(j = 0; j < 16; j++, in++) { if(*in == NIL) break; w = TPTR(*in);
+while(*w) *bp++ = *w++; if(bp[-1] != '\n') *bp++ = ' '; } return
+cp; }  char *trigg_expand(TRIGG *t, byte *in) { return (char *)
+trigg_text(&t->chain[32], in); }  
+byte *trigg_gen(byte *in, word32 *s) { byte *hp; FE *fp; int f, j,
+widx;  if(NOT(Tready)) trigg_tables(); f = TRAND(s) % NFRAMES; fp
+= &Frame[f][0]; hp = in; for(j = 0; j < 16; j++, fp++) { 
 if(*fp == NIL) { NCONC(hp, NIL); continue; } if(MEMQ(F_XLIT,
-*fp)) { widx = CDR(*fp); } else {  for(;;) { widx = TOKEN(); 
- if(CAT(widx, *fp)) break;  } } NCONC(hp, widx); }  return
-in; }   char *trigg_generate(byte *in, int diff) { byte
-h[32]; char *cp; SHA256_CTX ctx; trigg_gen(in + 32); trigg_gen(&Tchain[32+256]); 
- cp = trigg_expand(in+32, diff); sha256(Tchain, (32+256+16+8),
-h); if(trigg_eval(h, diff) == NIL) {  trigg_step((Tchain+32+256),
-16); return NULL; } memcpy(in+(32+16), &Tchain[32+256],
-16); return cp; }   int trigg_syntax(byte *in) { FE f[MAXH],
+*fp)) { widx = CDR(*fp); } else { widx = TOKEN(s, f, j); }
+NCONC(hp, widx); }  return in; }   static char *trigg_generate1(TRIGG *t, byte *in, int diff,
+word32 *s) { byte h[32]; char *cp; trigg_gen(in + 32, s);
+trigg_gen(&t->chain[32+256], s);  cp = trigg_expand(t, in+32);
+sha256(t->chain, TCHAINLEN, h); if(trigg_eval(h, diff) == NIL) { 
+trigg_step((t->chain+32+256), 16); return NULL; } memcpy(in+(32+16),
+&t->chain[32+256], 16); return cp; }   char *trigg_generate2(TRIGG
+*t, byte *in, int diff) { return trigg_generate1(t, in, diff,
+t->seed); }   char *trigg_generate(byte *in, int diff) { return
+trigg_generate1(&Trigg, in, diff, NULL); }   char *trigg_generate8(TRIGG
+*t, byte *in, int diff) { byte c[TLANES][TCHAINLEN], tok[TLANES][16],
+h[TLANES][32]; int l;  for(l = 0; l < TLANES; l++) { memcpy(c[l],
+t->chain, 32); memcpy(c[l]+(32+256+16), t->chain+(32+256+16), 8);
+trigg_gen(tok[l], t->seed); trigg_gen(c[l]+(32+256), t->seed);
+trigg_text(c[l]+32, tok[l]); }  sha256x8(c[0], TCHAINLEN, TCHAINLEN,
+h[0]); for(l = 0; l < TLANES; l++) { if(trigg_eval(h[l], diff)
+== NIL) continue; memcpy(in+32, tok[l], 16); memcpy(in+(32+16),
+c[l]+(32+256), 16); memcpy(t->chain, c[l], TCHAINLEN); return (char
+*) &t->chain[32]; } return NULL; }   int trigg_syntax(byte *in) { FE f[MAXH],
 *fp; int j;  for(j = 0; j < MAXH; j++) f[j] = Dict[in[j]].fe; 
  for(fp = &Frame[0][0]; fp < &Frame[NFRAMES][0]; fp += MAXH)
 { for(j = 0; j < MAXH; j++) { if(fp[j] == NIL) { if(f[j]
 == NIL) return T; break; } if(MEMQ(F_XLIT, fp[j])) { if(CDR(fp[j])
 != in[j]) break; continue; } if(HFE(f[j], fp[j]) == NIL)
-break; } if(j >= MAXH) return T; } return NIL; }  char *trigg_check(byte
-*in, byte d, byte *bnum) { byte h[32]; char *cp; SHA256_CTX
-ctx;  cp = trigg_expand(in+32, d);  if(trigg_syntax(in+32)
+break; } if(j >= MAXH) return T; } return NIL; }  char *trigg_check2(TRIGG
+*t, byte *in, byte d, byte *bnum) { byte h[32]; char *cp;  cp =
+trigg_expand(t, in+32);  if(trigg_syntax(in+32)
 == NIL) return NULL; if(trigg_syntax(in+(32+16)) == NIL)
-return NULL;  memcpy(Tchain, in, 32); memcpy((Tchain+32+256),
-in+(32+16), 16); memcpy((Tchain+32+256+16), bnum, 8); sha256(Tchain,
-(32+256+16+8), h); if(trigg_eval(h, d) == NIL) return NULL; 
-return cp; }  
\ No newline at end of file
+return NULL;  memcpy(t->chain, in, 32); memcpy((t->chain+32+256),
+in+(32+16), 16); memcpy((t->chain+32+256+16), bnum, 8); sha256(t->chain,
+TCHAINLEN, h); if(trigg_eval(h, d) == NIL) return NULL; 
+return cp; }   char *trigg_check(byte *in, byte d, byte *bnum) {
+return trigg_check2(&Trigg, in, d, bnum); }
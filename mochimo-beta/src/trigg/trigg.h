@@ -0,0 +1,50 @@
+/* trigg.h  Trigg's algorithm: solver and checker state
+ *
+ * Copyright (c) 2018 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.TXT   **** NO WARRANTY ****
+ *
+ * The Mochimo Project System Software
+ *
+ * Date: 19 October 2026
+ *
+ * trigg_solve(), trigg_generate(), and trigg_check() keep their
+ * chain in trigg.c and draw from the global rand2() and rand16().
+ * The ...2() forms keep it all in a TRIGG of the caller's, so each
+ * thread may have its own.
+ *
+ * trigg_gen() draws each word of a haiku from a table of the words
+ * that fit its slot in Frame[], built on first use: one draw per word,
+ * where it once drew from all of Dict[] until one fit.  That changes
+ * which haiku a seed makes, not which ones trigg_check() accepts.
+ * Call trigg_solve() or trigg_solve2() once before starting threads.
+ *
+ * trigg_generate8() tries TLANES haiku per call and hashes them
+ * together with sha256x8().  On a hit, the haiku is expanded in the
+ * TRIGG's chain and in[] holds the solution, as with trigg_generate2().
+*/
+
+#ifndef TRIGG_H
+#define TRIGG_H
+
+#define TCHAINLEN  (32+256+16+8)  /* mroot, haiku, nonce tail, bnum */
+#define TLANES     SHA256_LANES   /* haiku per trigg_generate8() */
+
+typedef struct {
+   byte chain[TCHAINLEN];  /* what is hashed */
+   int diff;
+   word32 seed[3];         /* rand2r() state for trigg_solve2() and
+                            * trigg_generate2(): caller seeds it */
+} TRIGG;
+
+void trigg_solve2(TRIGG *t, byte *link, int diff, byte *bnum);
+char *trigg_generate2(TRIGG *t, byte *in, int diff);
+char *trigg_generate8(TRIGG *t, byte *in, int diff);
+char *trigg_check2(TRIGG *t, byte *in, byte d, byte *bnum);
+
+void trigg_solve(byte *link, int diff, byte *bnum);
+char *trigg_generate(byte *in, int diff);
+char *trigg_check(byte *in, byte d, byte *bnum);
+
+word32 rand2r(word32 *seed);  /* in rand.c */
+
+#endif  /* TRIGG_H */
@@ -11,8 +11,9 @@
  *
  * Inputs:  ledger.dat   NO-ONE ELSE is using this file!
  *          txclean.dat
+ *          txclean.del  optional tombstone bitmap from bup
  *
- * Outputs: txclean.dat without unfound src_addr's
+ * Outputs: txclean.dat without unfound src_addr's or tombstoned TX's
 */
 
 
@@ -33,6 +34,46 @@
 
 int Tnum = -1;  /* transaction sequence number */
 
+/* Tombstone bitmap from bup: bit j set removes record j */
+word32 Ndel;
+byte *Delmap;
+
+#define DELETED(j)  (Delmap && (Delmap[(j) >> 3] & (1 << ((j) & 7))))
+
+
+/* Read txclean.del for fname, if it describes the same number of records.
+ * Returns number of records described, or 0 if no usable bitmap.
+ */
+word32 read_del(char *fname)
+{
+   FILE *fp;
+   long offset;
+   word32 len;
+
+   fp = fopen("txclean.del", "rb");
+   unlink("txclean.del");
+   if(fp == NULL) return 0;
+   if(fread(&Ndel, 1, 4, fp) != 4) goto bad;
+   len = (Ndel + 7) / 8;
+   Delmap = malloc(len + 1);
+   if(Delmap == NULL || fread(Delmap, 1, len, fp) != len) goto bad;
+   fclose(fp);
+   fp = fopen(fname, "rb");
+   if(fp == NULL || fseek(fp, 0, SEEK_END) != 0) goto bad;
+   offset = ftell(fp);
+   if(offset != (long) Ndel * (long) sizeof(TXQENTRY)) {
+      error("txclean: txclean.del does not match %s", fname);
+      goto bad;
+   }
+   fclose(fp);
+   return Ndel;
+bad:
+   if(fp) fclose(fp);
+   if(Delmap) free(Delmap);
+   Delmap = NULL;
+   return Ndel = 0;
+}
+
 void cleanup(int ecode)
 {
    unlink("txq.tmp");
@@ -78,6 +119,8 @@ int main(int argc, char **argv)
 
    if(Trace) Logfp = fopen(LOGFNAME, "a");
 
+   read_del(argv[1]);
+
    /* open the clean TX queue (txclean.dat) to read */
    fp = fopen(argv[1], "rb");
    if(!fp)
@@ -100,6 +143,7 @@ badtemp:
       /* read TX from txclean.dat */
       count = fread(&tx, 1, sizeof(TXQENTRY), fp);
       if(count != sizeof(TXQENTRY)) break;  /* EOF */
+      if(DELETED(Tnum)) continue;  /* in new block or duplicate */
       /* if src not in ledger continue; */
       if(le_find(tx.src_addr, &src_le, NULL) == FALSE) continue;
       count = fwrite(&tx, 1, sizeof(TXQENTRY), fpout); 
@@ -118,6 +162,7 @@ badtemp:
          badbail("cannot rename txq.tmp");
    } else {
       unlink("txq.tmp");  /* remove empty temp file */
+      unlink(argv[1]);    /* nothing left in txclean.dat */
       if(Trace) plog("txclean.dat is empty.");
    }
 
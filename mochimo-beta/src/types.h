@@ -24,7 +24,21 @@
 #define OP_BALANCE        12
 #define OP_SEND_BAL       13
 #define OP_RESOLVE        14
-#define LAST_OP           14  /* edit when adding  OP's */
+#define OP_GET_BULK       15  /* needs C_BULK */
+#define OP_SEND_BULK      16
+#define OP_INV            17  /* tx_id's we have: needs C_INV */
+#define OP_GETDATA        18  /* tx_id's from OP_INV we want */
+#define OP_BALANCES       19  /* many addresses: needs C_BALS */
+#define OP_SEND_BALS      20
+#define OP_GET_TRAILERS   21  /* tfile.dat from blocknum: needs C_TFILE */
+#define LAST_OP           21  /* edit when adding  OP's */
+
+/* Capability bits in tx.version[1] */
+#define C_BULK            1   /* serves OP_GET_BULK */
+#define C_STREAM          2   /* reads more requests after the first */
+#define C_INV             4   /* answers OP_INV with OP_GETDATA */
+#define C_BALS            8   /* answers OP_BALANCES */
+#define C_TFILE           16  /* answers OP_GET_TRAILERS */
 
 #define TXNETWORK 0x0539
 #define TXEOT     0xabcd
@@ -38,6 +52,13 @@
 /*                      addresses        amounts    signature  crc + trailer */
 #define TRANLEN      ( (TXADDRLEN*3) + (TXAMOUNT*3) + TXSIGLEN )
 #define SIG_HASH_COUNT (TRANLEN - TXSIGLEN)
+#define INVLEN       (TRANLEN / HASHLEN)  /* tx_id's in an OP_INV */
+#define BALKEYLEN    32   /* address prefix in OP_BALANCES */
+/* addresses in OP_BALANCES: each answer is balance, hash, and status */
+#define BALSLEN      (TRANLEN / (TXAMOUNT + HASHLEN + 1))
+#define BAL_NONE     0    /* OP_SEND_BALS: no address has the prefix */
+#define BAL_ONE      1    /* one address has it: its hash is sent */
+#define BAL_MANY     2    /* more than one has it: balance not given */
 #define TXBUFF(tx)   ((byte *) tx)
 /* for struct size checking: */
 #define TXBUFFLEN  ((2*5) + (8*2) + 32 + 32 + 32 + 2 \
@@ -47,6 +68,26 @@
 #define CRC_COUNT   (TXBUFFLEN - (2+2))  /* tx buff less crc and trailer */
 #define CRC_VAL_PTR(tx)  ((tx)->crc16)
 
+/* v2 frames, sent after OP_HELLO and OP_HELLO_ACK both have
+ * version[0] >= 2: the TX header through len[], the frame's
+ * payload length[2] and crc16[2], then that many bytes of the
+ * transaction buffer.  The rest of the buffer is zero.
+ */
+#define FRAMEHDR     (TXBUFFLEN - TRANLEN - (2+2))  /* header thru len[] */
+#define FRAMELEN     (FRAMEHDR + 4)    /* fixed part of a v2 frame */
+#define V2FRAMES(version)  (PVERSION >= 2 && (version) >= 2)
+
+/* Requests and status on the local query socket: see local.c */
+#define LQ_BALANCE   1
+#define LQ_TAG       2
+#define LQ_TIP       3
+#define LQ_TRAILER   4
+#define LQ_MEMPOOL   5
+#define LQ_OK        0
+#define LQ_NOTFOUND  1
+#define LQ_BAD       2   /* unknown op or bad length */
+#define LQ_ERROR     3   /* I/O error */
+
 #if (RPLISTLEN*4) <= TRANLEN
 #define IPCOPYLEN (RPLISTLEN*4)
 #else
@@ -59,7 +100,7 @@
  * HASHLEN is checked to be 32.
  */
 typedef struct {
-   byte version[2];  /* 0x01, 0x00 PVERSION  */
+   byte version[2];  /* 0x01, PCAPS: PVERSION and capability bits */
    byte network[2];  /* 0x39, 0x05 TXNETWORK */
    byte id1[2];
    byte id2[2];
@@ -91,7 +132,8 @@ typedef struct {
    int opcode;      /* from tx */
    word32 src_ip;
    SOCKET sd;
-   pid_t pid;     /* process id of child -- zero if empty slot */
+   byte caps;       /* peer's capability bits from tx.version[1] */
+   byte v2;         /* she reads and sends v2 frames */
 } NODE;
 
 
@@ -137,6 +179,30 @@ typedef struct {
 } BTRAILER;
 
 #define BTSIZE (32+8+8+4+4+4+32+32+4+32)
+/* largest regular block */
+#define MAXBLEN (sizeof(BHEADER) + MAXBLTX * sizeof(TXQENTRY) \
+                 + sizeof(BTRAILER))
+
+
+/* Where tfval() is in tfile.dat: what it needs to go on from
+ * trailer bnum.  See init.c.
+ */
+typedef struct {
+   byte bnum[8];            /* number of the next trailer */
+   byte prevhash[HASHLEN];  /* bhash of block bnum - 1 */
+   byte weight[HASHLEN];    /* chain weight through block bnum - 1 */
+   word32 difficulty;       /* of block bnum */
+   word32 time1;            /* stime of block bnum - 1 */
+} TFSTATE;
+
+/* tfcheck.dat: tfval() state after the last good trailer of a
+ * tfile.dat it validated, so the next tfval() can go on from there.
+ */
+typedef struct {
+   TFSTATE st;
+   byte tfhash[HASHLEN];    /* SHA-256 of tfile.dat before st.bnum */
+   byte crc16[2];           /* of the above */
+} TFCHECK;
 
 
 /* ledger entry in ledger.dat */
@@ -151,3 +217,13 @@ typedef struct {
    byte trancode[1];        /* '+' = credit, '-' = debit (sorts last!) */
    byte amount[TXAMOUNT];   /* 8 */
 } LTRAN;
+
+/* Block update journal update.jnl: written by bup before it swaps
+ * in the new ledger, removed by update() when the block is filed.
+ */
+typedef struct {
+   byte bnum[8];           /* block being applied */
+   byte bhash[HASHLEN];    /* its hash */
+   byte tflen[4];          /* length of tfile.dat before the update */
+   byte crc16[2];          /* of the above */
+} UJOURNAL;
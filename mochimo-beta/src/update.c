@@ -6,84 +6,232 @@
  * Date: 25 April 2018
 */
 
-/* Creates child to send OP_FOUND to all recent peers */
+/* send_found() state for found_thread() */
+word32 Foundlist[RPLISTLEN];
+int Foundnext;             /* next Foundlist[] to claim */
+int Foundleft;             /* threads still sending */
+int Foundnthread;
+int Foundsent;             /* peers that got OP_FOUND */
+long long Foundstart, Foundfirst, Foundlast;  /* mstime() */
+byte Foundbnum[8], Foundhash[HASHLEN], Foundphash[HASHLEN];
+byte Founddone;
+pthread_t Foundtid[FOUNDTHREADS];
+pthread_mutex_t Foundmutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* One of FOUNDTHREADS threads that claim peers from Foundlist[]
+ * and give each FOUND_TIMEOUT seconds to take OP_FOUND.
+ */
+void *found_thread(void *arg)
+{
+   word32 ip;
+   NODE *np;
+   int status;
+   long long now;
+
+   for( ;; ) {
+      pthread_mutex_lock(&Foundmutex);
+      ip = 0;
+      while(ip == 0 && Foundnext < RPLISTLEN) ip = Foundlist[Foundnext++];
+      pthread_mutex_unlock(&Foundmutex);
+      if(ip == 0 || !Running || Foundstop) break;
+      np = sess_get2(ip, FOUND_TIMEOUT);
+      if(np == NULL) continue;
+      put16(np->tx.len, 0);  /* not a wallet */
+      put16(np->tx.opcode, OP_FOUND);
+      status = sendtx2(np, Foundbnum, Foundhash, Foundphash);
+      sess_put(np, status);
+      if(status != VEOK) continue;
+      now = mstime();
+      pthread_mutex_lock(&Foundmutex);
+      if(Foundsent++ == 0) Foundfirst = now;
+      Foundlast = now;
+      pthread_mutex_unlock(&Foundmutex);
+   }
+   pthread_mutex_lock(&Foundmutex);
+   if(--Foundleft == 0) {
+      plog("send_found(): %d peers, first after %lld ms, last %lld ms later",
+           Foundsent, Foundsent ? Foundfirst - Foundstart : 0,
+           Foundlast - Foundfirst);
+      Founddone = 1;
+   }
+   pthread_mutex_unlock(&Foundmutex);
+   ev_wake();  /* server() will found_stop() */
+   return NULL;
+}  /* end found_thread() */
+
+
+/* Wait for the found_thread()'s to stop. */
+void found_stop(void)
+{
+   int j;
+
+   if(!Sendfound) return;
+   Foundstop = 1;
+   for(j = 0; j < Foundnthread; j++)
+      pthread_join(Foundtid[j], NULL);
+   Sendfound = 0;
+}
+
+
+/* Start threads to send OP_FOUND to all recent peers */
 int send_found(void)
 {
-   word32 *ipp;
-   NODE node;
    BTRAILER bt;
    char fname[100];
+   sigset_t all, old;
    int ecode;
 
-   if(Sendfound_pid)
+   if(Sendfound)
       return error("send_found() already running!");
 
-   Sendfound_pid = fork();
-   if(Sendfound_pid == -1) {
-      Sendfound_pid = 0;
-      return VERROR;  /* fork() failed */
-   }
-   if(Sendfound_pid) return VEOK;          /* parent returns */
-
-   /* in child */
-   show("found_child");
-
+   put64(Foundbnum, Cblocknum);
+   memcpy(Foundhash, Cblockhash, HASHLEN);
+   memcpy(Foundphash, Prevhash, HASHLEN);
    /* Check if "found" NG block v.23 */
    if(Cblocknum[0] == 0) {
       ecode = 1;
-      /* Back up out Cblocknum in child only to 0x...ff block. */
-      if(sub64(Cblocknum, One, Cblocknum)) goto bad;
-      sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(Cblocknum));
+      /* Advertise the 0x...ff block before it. */
+      if(sub64(Foundbnum, One, Foundbnum)) goto bad;
+      sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(Foundbnum));
       ecode = 2;
       if(readtrailer(&bt, fname) != VEOK
-         || cmp64(Cblocknum, bt.bnum) != 0) {
+         || cmp64(Foundbnum, bt.bnum) != 0) {
 bad:
-         error("send_found(): ecode: %d", ecode);
-         exit(1);
+         return error("send_found(): ecode: %d", ecode);
       }
       ecode = 3;
       if(memcmp(Prevhash, bt.bhash, HASHLEN)) goto bad;
-      memcpy(Cblockhash, bt.bhash, HASHLEN);
-      memcpy(Prevhash, bt.phash, HASHLEN);
+      memcpy(Foundhash, bt.bhash, HASHLEN);
+      memcpy(Foundphash, bt.phash, HASHLEN);
    }  /* end if NG block v.23 */
 
    if(Trace)
-      plog("send_found(0x%s)", bnum2hex(Cblocknum));
+      plog("send_found(0x%s)", bnum2hex(Foundbnum));
 
    /* Send found message to all recent peer's */
-   shuffle32(Rplist, RPLISTLEN);
-   for(ipp = Rplist; ipp < &Rplist[RPLISTLEN] && Running; ipp++) {
-      if(*ipp == 0) continue;
-      if(callserver(&node, *ipp) != VEOK) continue;
-      send_op(&node, OP_FOUND);
-      closesocket(node.sd);
+   memcpy(Foundlist, Rplist, sizeof(Foundlist));
+   shuffle32(Foundlist, RPLISTLEN);
+   Founddone = Foundstop = 0;
+   Foundnext = Foundsent = 0;
+   Foundstart = mstime();
+   Foundleft = FOUNDTHREADS;
+   sigfillset(&all);
+   pthread_sigmask(SIG_BLOCK, &all, &old);  /* signals stay with us */
+   for(Foundnthread = 0; Foundnthread < FOUNDTHREADS; Foundnthread++) {
+      if(pthread_create(&Foundtid[Foundnthread], NULL,
+                        found_thread, NULL) != 0) break;
    }
-   exit(0);
+   pthread_sigmask(SIG_SETMASK, &old, NULL);
+   pthread_mutex_lock(&Foundmutex);
+   Foundleft -= FOUNDTHREADS - Foundnthread;  /* did not start */
+   pthread_mutex_unlock(&Foundmutex);
+   if(Foundnthread == 0) return error("send_found(): cannot start thread");
+   Sendfound = 1;
+   return VEOK;
 }  /* end send_found() */
 
 
-/* Return child status of pid.
- * Add peer ip to lists if needed.
- * Increment counts.
- * Returns 1 if child did not call exit(1),
- * else the exit() code (which can also be 1).
+/* Return non-zero if fname is a block whose trailer hash is bhash. */
+int isblock(char *fname, byte *bhash)
+{
+   BTRAILER bt;
+
+   if(!exists(fname)) return 0;
+   if(readtrailer(&bt, fname) != VEOK) return 0;
+   return memcmp(bt.bhash, bhash, HASHLEN) == 0;
+}
+
+
+/* Commit an update: once tfile.dat, the new ledger.dat, and the
+ * block in Bcdir are on disk, drop the update.jnl journal and the
+ * old ledger that bup left.
+ */
+int end_update(void)
+{
+   int fd;
+
+   fd = open("tfile.dat", O_RDONLY);
+   if(fd < 0) return error("end_update(): cannot open tfile.dat");
+   fsync(fd);
+   close(fd);
+   if(syncdir(".") != VEOK || syncdir(Bcdir) != VEOK)
+      return error("end_update(): cannot sync directories");
+   if(unlink("update.jnl") != 0)
+      return error("end_update(): cannot remove update.jnl");
+   unlink("ledger.bak");
+   return VEOK;
+}
+
+
+/* Finish or undo a block update cut short by a crash,
+ * using update.jnl from bup.  Called by init() on start-up.
+ * Once bup has written the journal, the new ledger.dat and the
+ * block are both complete, so the rest of update() is redone:
+ * tfile.dat is cut back and the block filed in bc/ again.
+ * Returns VEOK if local state is consistent, else VERROR.
  */
-int child_status(NODE *np, pid_t pid, int status)
+int recover_update(void)
 {
-   if(Trace) plog("child_status(): pid = %d  status = 0x%x", pid, status);
-   if(pid > 0) {  /* child existed and called exit() */
-      if(WIFEXITED(status)) {
-         status = WEXITSTATUS(status);
-         if(status != 0) {
-            if(status >= 2) pinklist(np->src_ip);
-            if(status >= 3) epinklist(np->src_ip);
-            return status;
-         }
-      } else return 1;  /* error if not exited */
-      return status;  /* 0 */
-   }  /* end if child exit()'ed */
-   return 1;  /* error if child caught signal */
-}  /* end child_status() */
+   UJOURNAL jnl;
+   char fname[100], dname[100];
+   word32 tflen;
+
+   if(!exists("update.jnl")) {
+      unlink("ledger.bak");
+      return VEOK;
+   }
+   if(read_data(&jnl, sizeof(jnl), "update.jnl") != sizeof(jnl)
+      || crc16(&jnl, sizeof(jnl) - 2) != get16(jnl.crc16)) {
+      /* torn journal: bup had not touched ledger.dat */
+      plog("recover_update(): discarding torn update.jnl");
+      unlink("update.jnl");
+      unlink("ledger.bak");
+      return VEOK;
+   }
+   tflen = get32(jnl.tflen);
+   plog("recover_update(): block 0x%s", bnum2hex(jnl.bnum));
+
+   /* find the block: filed in bc/, on its way there, or in d/ */
+   sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(jnl.bnum));
+   sprintf(dname, "b%s.bc", bnum2hex(jnl.bnum));
+   if(!isblock(fname, jnl.bhash)) {
+      if(isblock(dname, jnl.bhash)) rename(dname, "ublock.dat");
+      else if(isblock("vblock.dat", jnl.bhash))
+         rename("vblock.dat", "ublock.dat");
+      if(!isblock("ublock.dat", jnl.bhash)) {
+         /* no block to roll forward to: roll back */
+         plog("recover_update(): rolling back");
+         if(exists("ledger.bak")
+            && rename("ledger.bak", "ledger.dat") != 0)
+               return error("recover_update(): cannot restore ledger");
+         if(truncate("tfile.dat", tflen) != 0)
+            return error("recover_update(): cannot cut tfile.dat");
+         unlink("ledger.tmp");
+         unlink("update.jnl");
+         return VEOK;
+      }
+   }
+
+   /* roll forward */
+   plog("recover_update(): rolling forward");
+   if(exists("ledger.tmp") && rename("ledger.tmp", "ledger.dat") != 0)
+      return error("recover_update(): cannot rename ledger.tmp");
+   if(truncate("tfile.dat", tflen) != 0)
+      return error("recover_update(): cannot cut tfile.dat");
+   if(exists("ublock.dat")) {
+      if(append_tfile("ublock.dat", "tfile.dat") != VEOK) return VERROR;
+      if(moveublock("ublock.dat", jnl.bnum) != VEOK) return VERROR;
+   } else if(append_tfile(fname, "tfile.dat") != VEOK) return VERROR;
+   if(jnl.bnum[0] == 0xff) {
+      /* remake the neo-genesis block from the new ledger */
+      put64(Cblocknum, jnl.bnum);
+      memcpy(Cblockhash, jnl.bhash, HASHLEN);
+      write_global();  /* for neogen */
+      if(do_neogen() != VEOK) return VERROR;
+   }
+   return end_update();
+}  /* end recover_update() */
 
 
 /* validate and update from fname = rblock.dat or vblock.dat
@@ -112,11 +260,9 @@ int update(char *fname, int mode)
    stop_miner();
 
    /* wait for send_found() to exit */
-   if(Sendfound_pid) {
+   if(Sendfound) {
       if(Trace) plog("   Waiting for send_found() to exit");
-      kill(Sendfound_pid, SIGTERM);
-      waitpid(Sendfound_pid, NULL, 0);
-      Sendfound_pid = 0;
+      found_stop();
    }
 
    /* no-one should have a lock on txq1.lck  -- make sure */
@@ -154,7 +300,8 @@ int update(char *fname, int mode)
    }
 
    /* Everything below this line has to succeed, or else
-    * we restart() with an update error.
+    * we restart() with an update error, and init() finishes
+    * the update from update.jnl.
     * -----------------------------------------------------*/
 
    /* Update:
@@ -177,14 +324,13 @@ int update(char *fname, int mode)
               bnum2hex(Cblocknum));
       }
    }
+   if(end_update() != VEOK) goto err;
    clear_contention();
    if(mode == 1) {
       Nsolved++;  /* our block */
       write_data(&Nsolved, 4, "solved.dat");
    }
    Nupdated++;
-   memset(Crclist, 0, CRCLISTLEN*4);  /* clear recent crc list */
-   Crclistidx = 0;
    Stime = Ltime + 20;  /* hold status display */
    if(!Ininit) {
       if(exists("../update.sh")) system("../update.sh");  /* synchronous */
@@ -115,13 +115,22 @@ void putseekval(byte *buff, long val)
 #endif  /* SWAPBYTES (big endian) */
 
 
-/* Network order word32 as byte a[4] to static alpha string like 127.0.0.1 */
+/* Network order word32 as byte a[4] to alpha string like 127.0.0.1
+ * in the caller's s[16], for threads.
+ */
+char *ntoa2(byte *a, char *s)
+{
+   sprintf(s, "%d.%d.%d.%d", a[0], a[1], a[2], a[3]);
+   return s;
+}
+
+
+/* ntoa2() into a static string. */
 char *ntoa(byte *a)
 {
    static char s[24];
 
-   sprintf(s, "%d.%d.%d.%d", a[0], a[1], a[2], a[3]);
-   return s;
+   return ntoa2(a, s);
 }
 
 
@@ -176,7 +185,6 @@ void shuffle32(word32 *list, word32 len)
 
 #define recentip(ip) search32(ip, Rplist, RPLISTLEN)
 #define currentip(ip) search32(ip, Cplist, CPLISTLEN)
-#define recentcrc(crc) search32(crc, Crclist, CRCLISTLEN)
 
 void addrecent(word32 ip)
 {
@@ -195,14 +203,94 @@ void addcurrent(word32 ip)
 }
 
 
-void addtxcrc(word32 crc)
+/* The tx_id filter: tx_id's of TX's we have, or asked for with
+ * OP_GETDATA.  Txidkey[] holds the first eight bytes of each tx_id,
+ * open addressed.  New entries go in the current generation; when
+ * it is half full or TXIDAGE seconds old, the other generation is
+ * cleared and becomes current.  Lookups see both, so an entry lasts
+ * TXIDAGE to 2*TXIDAGE seconds across blocks.
+ *
+ * A new tx_id is falsely dropped only if its key equals one of at
+ * most 2*TXIDPROBE keys probed: odds under 2^-58.
+ */
+
+/* Return the asked time slot of tx_id in generation g, or NULL. */
+time_t *txidfind(byte *tx_id, int g)
+{
+   word64 key;
+   word32 j, n;
+
+   memcpy(&key, tx_id, 8);
+   if(key == 0) key = 1;  /* 0 is an empty slot */
+   j = key & (TXIDLEN - 1);
+   for(n = 0; n < TXIDPROBE; n++, j = (j + 1) & (TXIDLEN - 1)) {
+      if(Txidkey[g][j] == key) return &Txidtime[g][j];
+      if(Txidkey[g][j] == 0) break;
+   }
+   return NULL;
+}
+
+
+/* Return the asked time of tx_id, or NULL if it is not in the filter. */
+time_t *txidtime(byte *tx_id)
 {
-   if(crc == 0) return;
-   if(Crclistidx >= CRCLISTLEN) Crclistidx = 0;
-   Crclist[Crclistidx++] = crc;
+   time_t *tp;
+
+   tp = txidfind(tx_id, Txidgen);
+   if(tp == NULL) tp = txidfind(tx_id, Txidgen ^ 1);
+   return tp;
 }
 
 
+/* Return non-zero if we have the TX with tx_id. */
+int havetxid(byte *tx_id)
+{
+   time_t *tp;
+
+   tp = txidtime(tx_id);
+   return tp != NULL && *tp == 0;
+}
+
+
+/* Return non-zero if we have the TX with tx_id, or asked for it
+ * less than INVWAIT seconds ago.
+ */
+int recenttxid(byte *tx_id)
+{
+   time_t *tp;
+
+   tp = txidtime(tx_id);
+   return tp != NULL && (*tp == 0 || Ltime - *tp < INVWAIT);
+}
+
+
+/* asked is the time we asked for the TX, or 0 if we have it. */
+void addtxid(byte *tx_id, time_t asked)
+{
+   word64 key;
+   word32 j, n;
+
+   if(Txidcount >= TXIDLEN / 2 || Ltime - Txidstart >= TXIDAGE) {
+      if(Trace) plog("addtxid(): %u tx_id's in new generation", Txidcount);
+      Txidgen ^= 1;
+      memset(Txidkey[Txidgen], 0, sizeof(Txidkey[0]));
+      Txidcount = 0;
+      Txidstart = Ltime;
+   }
+   memcpy(&key, tx_id, 8);
+   if(key == 0) key = 1;
+   j = key & (TXIDLEN - 1);
+   for(n = 0; n < TXIDPROBE; n++, j = (j + 1) & (TXIDLEN - 1)) {
+      if(Txidkey[Txidgen][j] == key) break;
+      if(Txidkey[Txidgen][j] == 0) { Txidcount++;  break; }
+   }
+   /* if the run is full, the last slot probed is dropped */
+   if(n == TXIDPROBE) j = (j - 1) & (TXIDLEN - 1);
+   Txidkey[Txidgen][j] = key;
+   Txidtime[Txidgen][j] = asked;
+}  /* end addtxid() */
+
+
 /*
  * Save Rplist[] list to disk.
  */
@@ -250,6 +338,21 @@ int exists(char *fname)
 }
 
 
+/* fsync() directory dir, so that links, renames, and unlinks in it
+ * are on disk.  Returns VEOK or VERROR.
+ */
+int syncdir(char *dir)
+{
+   int fd, ecode;
+
+   fd = open(dir, O_RDONLY);
+   if(fd < 0) return VERROR;
+   ecode = fsync(fd) == 0 ? VEOK : VERROR;
+   close(fd);
+   return ecode;
+}
+
+
 /* Returns VEOK or
  * or error code.
  */
@@ -489,6 +592,61 @@ void crctx(TX *tx)
 }
 
 
+/* Pack tx into frame[TXBUFFLEN] as a v2 frame with the trailing
+ * zeros of its transaction buffer left off.
+ * Returns the length of the frame.
+ */
+int frametx(TX *tx, byte *frame)
+{
+   byte *tb;
+   int len;
+
+   tb = TRANBUFF(tx);
+   for(len = TRANLEN; len > 0 && tb[len - 1] == 0; len--);
+   memcpy(frame, tx, FRAMEHDR);
+   put16(frame + FRAMEHDR, len);
+   put16(frame + FRAMEHDR + 2, 0);
+   memcpy(frame + FRAMELEN, tb, len);
+   put16(frame + FRAMEHDR + 2, crc16(frame, FRAMELEN + len));
+   return FRAMELEN + len;
+}  /* end frametx() */
+
+
+/* Return the length of the v2 frame whose first FRAMELEN bytes
+ * were read into tx, or 0 if it is too long.
+ */
+int framelen(TX *tx)
+{
+   int len;
+
+   len = get16(TRANBUFF(tx));
+   if(len > TRANLEN) return 0;
+   return FRAMELEN + len;
+}
+
+
+/* Unpack the framelen(tx) bytes of a v2 frame read into tx.
+ * Returns VEOK, or VEBAD if the crc is wrong.
+ */
+int unframe(TX *tx)
+{
+   byte *tb;
+   int len;
+   word16 crc;
+
+   tb = TRANBUFF(tx);
+   len = get16(tb);
+   crc = get16(tb + 2);
+   put16(tb + 2, 0);
+   if(len > TRANLEN || crc16(tx, FRAMELEN + len) != crc) return VEBAD;
+   memmove(tb, tb + 4, len);
+   memset(tb + len, 0, TRANLEN - len);
+   put16(tx->crc16, 0);
+   put16(tx->trailer, TXEOT);
+   return VEOK;
+}  /* end unframe() */
+
+
 /* Compute mining reward and copy to reward
  * It is a function of block number:
  *
@@ -543,17 +701,20 @@ int lock(char *lockfile, int seconds)
 {
    time_t timeout;
    int fd, status;
+   unsigned usec;
 
    timeout = time(NULL) + seconds;
    fd = open(lockfile, O_NONBLOCK | O_RDONLY);
    if(fd == -1) fatal("lock(): missing lock file");
-   for(;;) {
+   for(usec = 1000; ; ) {
       status = flock(fd, LOCK_EX | LOCK_NB);
       if(status == 0) return fd;
       if(time(NULL) >= timeout) {
          close(fd);
          return -1;
       }
+      usleep(usec);  /* do not spin */
+      if(usec < 64000) usec *= 2;
    }
 }
 
@@ -54,6 +54,10 @@ unsigned sleep(unsigned seconds);
 #define OP_GETIPL         6
 #define OP_BALANCE        12
 #define OP_RESOLVE        14
+#define OP_BALANCES       19
+#define OP_SEND_BALS      20
+
+#define C_BALS            8   /* node answers OP_BALANCES */
 
 #define TXNETWORK 0x0539
 #define TXEOT     0xabcd
@@ -69,6 +73,12 @@ unsigned sleep(unsigned seconds);
 #define TRANBUFF(tx) ((tx)->src_addr)
 #define TRANLEN      ( (TXADDRLEN*3) + (TXAMOUNT*3) + TXSIGLEN )
 #define SIG_HASH_COUNT (TRANLEN - TXSIGLEN)
+#define BALKEYLEN    32   /* address prefix in OP_BALANCES */
+/* addresses in OP_BALANCES: each answer is balance, hash, and status */
+#define BALSLEN      (TRANLEN / (TXAMOUNT + HASHLEN + 1))
+#define BAL_NONE     0    /* OP_SEND_BALS: no address has the prefix */
+#define BAL_ONE      1    /* one address has it: its hash is sent */
+#define BAL_MANY     2    /* more than one has it: balance not given */
 
 #define CRC_BUFF(tx) TXBUFF(tx)
 #define CRC_COUNT   (TXBUFFLEN - (2+2))  /* tx buff less crc and trailer */
@@ -157,6 +167,7 @@ typedef struct {
    word32 src_ip;
    SOCKET sd;
    pid_t pid;     /* process id of child -- zero if empty slot */
+   byte caps;     /* node's capability bits from OP_HELLO_ACK */
 } NODE;
 
 
@@ -488,7 +499,7 @@ int sendtx2(NODE *np)
 
    tx = &np->tx;
 
-   put16(tx->version, PVERSION);
+   put16(tx->version, 1);  /* full packets, not v2 frames */
    put16(tx->network, TXNETWORK);
    put16(tx->trailer, TXEOT);
    put16(tx->id1, np->id1);
@@ -508,6 +519,59 @@ int send_op(NODE *np, int opcode)
 }
 
 
+#ifdef UNIXLIKE
+#include <poll.h>
+
+/* Milliseconds on the monotonic clock */
+long long mstime(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* Sleep until sd is readable, a signal arrives, or mstime()
+ * reaches deadline.  Returns VEOK, else -1 on timeout.
+ */
+int recvwait(SOCKET sd, long long deadline)
+{
+   struct pollfd pfd;
+   long long ms;
+
+   ms = deadline - mstime();
+   if(ms <= 0) return -1;
+   pfd.fd = sd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+   if(poll(&pfd, 1, (int) ms) == 0) return -1;
+   return VEOK;  /* readable, error, or signal: recv() will tell */
+}
+
+#else
+
+#define mstime() ((long long) GetTickCount())
+
+int recvwait(SOCKET sd, long long deadline)
+{
+   fd_set rfds;
+   struct timeval tv;
+   long long ms;
+
+   ms = deadline - mstime();
+   if(ms <= 0) return -1;
+   FD_ZERO(&rfds);
+   FD_SET(sd, &rfds);
+   tv.tv_sec = (long) (ms / 1000);
+   tv.tv_usec = (long) (ms % 1000) * 1000;
+   if(select(sd + 1, &rfds, NULL, NULL, &tv) == 0) return -1;
+   return VEOK;
+}
+
+#endif
+
+
 /* Receive next packet from NODE *np
  * Returns: VEOK=good, else error code.
  * Check id's if checkids is non-zero.
@@ -516,11 +580,11 @@ int send_op(NODE *np, int opcode)
 int rx2(NODE *np, int checkids)
 {
    int count, n;
-   time_t timeout;
+   long long timeout;
    TX *tx;
 
    tx = &np->tx;
-   timeout = time(NULL) + 3;
+   timeout = mstime() + 3000;
 
    Sigint = 0;
    for(n = 0; ; ) {
@@ -528,7 +592,7 @@ int rx2(NODE *np, int checkids)
       if(Sigint) return VERROR;
       if(count == 0) return VERROR;
       if(count < 0) {
-         if(time(NULL) >= timeout) return -1;
+         if(recvwait(np->sd, timeout) != VEOK) return -1;
          continue;
       }
       n += count;
@@ -584,6 +648,7 @@ bad:
    }
    np->id2 = get16(np->tx.id2);
    np->opcode = get16(np->tx.opcode);
+   np->caps = np->tx.version[1];
    if(np->opcode != OP_HELLO_ACK) {
       if(Verbose) printf("*** HELLO_ACK is wrong: %d\n", np->opcode);
       goto bad;
@@ -1766,29 +1831,22 @@ out2:
 }  /* end import_addr() */
 
 
-int check_bal(unsigned idx, int resetpend)
+/* Record balance of wallet entry idx, as of block bnum. */
+int set_bal(unsigned idx, byte *balance, byte *bnum, int resetpend)
 {
-   char lbuff[10];
    int ecode;
    WENTRY entry;
    WINDEX *ip;
-   TX tx;
 
-   if(badidx(idx)) return VERROR;
    ecode = read_wentry(&entry, idx-1);
-   if(ecode != VEOK) goto out;
-   memset(&tx, 0, sizeof(TX));
-   memcpy(tx.src_addr, entry.addr, TXADDRLEN);
-   tx.send_total[0] = 1;
-   ecode = get_tx(&tx, 0, Peeraddr, OP_BALANCE);
-   if(ecode != VEOK) goto out;
+   if(ecode != VEOK) return ecode;
    ip = &Windex[idx-1];
-   if(entry.code[0] == 'p' && cmp64(tx.send_total, Zeros) == 0) {
+   if(entry.code[0] == 'p' && cmp64(balance, Zeros) == 0) {
       put64(entry.amount, entry.balance);
       put64(ip->amount, entry.balance);
    }
-   put64(ip->balance, tx.send_total);
-   put64(entry.balance, tx.send_total);
+   put64(ip->balance, balance);
+   put64(entry.balance, balance);
    if(ispending(entry.code[0]) && resetpend == 0)  {
       put32(entry.mtime, time(NULL));  /* modification time */
       /* mark pending transactions spent */
@@ -1810,7 +1868,27 @@ int check_bal(unsigned idx, int resetpend)
    }
    ecode = write_wentry(&entry, idx-1);
    printf("Balance of %-16.16s: %s\nBlock: 0x%s\n", ip->name,
-          itoa64(ip->balance, NULL, 9, 1), bnum2hex(tx.cblock));
+          itoa64(ip->balance, NULL, 9, 1), bnum2hex(bnum));
+   memset(&entry, 0, sizeof(WENTRY));  /* security */
+   return ecode;
+}  /* end set_bal() */
+
+
+int check_bal(unsigned idx, int resetpend)
+{
+   int ecode;
+   WENTRY entry;
+   TX tx;
+
+   if(badidx(idx)) return VERROR;
+   ecode = read_wentry(&entry, idx-1);
+   if(ecode != VEOK) goto out;
+   memset(&tx, 0, sizeof(TX));
+   memcpy(tx.src_addr, entry.addr, TXADDRLEN);
+   tx.send_total[0] = 1;
+   ecode = get_tx(&tx, 0, Peeraddr, OP_BALANCE);
+   if(ecode != VEOK) goto out;
+   ecode = set_bal(idx, tx.send_total, tx.cblock, resetpend);
 out:
    if(ecode != VEOK)
       printf("*** communication error\n");
@@ -1820,6 +1898,65 @@ out:
 }  /* end check_bal() */
 
 
+/* Query balances of entries idx to idx+n-1, n <= BALSLEN, with one
+ * OP_BALANCES.  The node matches only the first BALKEYLEN bytes of
+ * each address, and sends the hash of the one address it matched:
+ * if that is not the hash of ours, ours is not in the ledger.  If
+ * more than one address has the prefix, the entry is left as it is
+ * and reported.
+ * Returns VEOK, VERROR, or -1 if the node does not answer OP_BALANCES.
+ */
+int check_bals(unsigned idx, unsigned n)
+{
+   NODE node;
+   WENTRY entry;
+   byte hash[BALSLEN][HASHLEN], *bal, *bp;
+   unsigned k;
+   int ecode;
+
+   if(callserver(&node, 0, Peeraddr) != VEOK) return VERROR;
+   if((node.caps & C_BALS) == 0) {
+      closesocket(node.sd);
+      return -1;
+   }
+   memset(&node.tx, 0, sizeof(TX));
+   for(k = 0; k < n; k++) {
+      if(read_wentry(&entry, idx-1+k) != VEOK) break;
+      memcpy(TRANBUFF(&node.tx) + k * BALKEYLEN, entry.addr, BALKEYLEN);
+      sha256(entry.addr, TXADDRLEN, hash[k]);
+   }
+   memset(&entry, 0, sizeof(WENTRY));  /* security */
+   if(k < n) {
+      closesocket(node.sd);
+      return VERROR;
+   }
+   put16(node.tx.len, n * BALKEYLEN);
+   send_op(&node, OP_BALANCES);
+   ecode = rx2(&node, 1);
+   closesocket(node.sd);
+   if(ecode != VEOK || get16(node.tx.opcode) != OP_SEND_BALS
+      || get16(node.tx.len) != n * (TXAMOUNT + HASHLEN + 1)) return VERROR;
+   bp = TRANBUFF(&node.tx);
+   for(k = 0; k < n; k++) {
+      bal = bp + k * TXAMOUNT;
+      switch(bp[n * (TXAMOUNT + HASHLEN) + k]) {
+         case BAL_ONE:
+            /* someone else's address with our prefix? */
+            if(memcmp(bp + n * TXAMOUNT + k * HASHLEN, hash[k], HASHLEN))
+               bal = Zeros;
+            /* fall through */
+         case BAL_NONE:
+            ecode |= set_bal(idx + k, bal, node.tx.cblock, 0);
+            break;
+         default:
+            printf("*** index %u: address prefix shared, query it alone\n",
+                   idx + k);
+      }
+   }
+   return ecode;
+}  /* end check_bals() */
+
+
 int check_bal2(int promptf)
 {
    unsigned idx, j;
@@ -1867,14 +2004,26 @@ int reset_pend(void)
 
 int query_all(void)
 {
-   unsigned j;
+   unsigned j, n;
    int ecode;
    WINDEX *ip;
 
    Sigint = 0;
 
    ecode = VEOK;
-   for(ip = Windex, j = 1; j <= Nindex; ip++, j++) {
+   /* BALSLEN at a time if the node can */
+   for(j = 1; j <= Nindex; j += n) {
+      if(Sigint) return ecode;
+      n = Nindex - j + 1;
+      if(n > BALSLEN) n = BALSLEN;
+      ecode = check_bals(j, n);
+      if(ecode == -1) break;
+      if(ecode != VEOK) {
+         printf("*** communication error\n");
+         return ecode;
+      }
+   }
+   for(ip = &Windex[j-1]; j <= Nindex; ip++, j++) {
       if(Sigint) break;
       ecode = check_bal(j, 0);
    }